@@ -3,7 +3,14 @@
 //    (See accompanying file LICENSE_1_0.txt or copy at
 //          http://www.boost.org/LICENSE_1_0.txt)
 
+#include <fcntl.h>
+#include <getopt.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
 
 #include <boost/filesystem.hpp>
 
@@ -15,11 +22,55 @@
 
 #include <ebbrt-cmdline/CmdLineArgs.h>
 
-enum : ebbrt::EbbId {
-  kCmdLineArgsId = ebbrt::kFirstStaticUserId
-};
+#include "src/DatasetFeed.h"
+#include "src/StaticEbbIds.h"
+
+namespace {
+/**
+ * MapDataset() - map the --preload file for the node to fetch, it stays
+ * mapped until we exit
+ */
+bool MapDataset(const char *path, const void **data, size_t *len) {
+  auto fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    return false;
+  }
+  *len = st.st_size;
+  *data = nullptr;
+  if (*len > 0) {
+    *data = mmap(nullptr, *len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (*data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+  }
+  close(fd);
+  return true;
+}
+} // namespace
 
 int main(int argc, char **argv) {
+  // --preload FILE also reaches the node through CmdLineArgs, which then
+  // fetches the file from us before it starts listening
+  static const option longopts[] = {{"preload", required_argument, 0, 'p'},
+                                    {0, 0, 0, 0}};
+  const char *preload = nullptr;
+  int ch;
+  while ((ch = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+    if (ch != 'p') {
+      std::fprintf(stderr, "usage: Memcached [--preload FILE]\n");
+      return 2;
+    }
+    preload = optarg;
+  }
+  const void *data = nullptr;
+  size_t len = 0;
+  if (preload && !MapDataset(preload, &data, &len)) {
+    std::fprintf(stderr, "Memcached: cannot map %s\n", preload);
+    return 1;
+  }
+
   auto bindir = boost::filesystem::system_complete(argv[0]).parent_path() /
                 "/bm/memcached.elf32";
   ebbrt::Runtime runtime;
@@ -32,9 +83,19 @@ int main(int argc, char **argv) {
     sig.async_wait([&c](const boost::system::error_code &ec,
                         int signal_number) { c.io_service_.stop(); });
     CmdLineArgs::Create(argc, argv, kCmdLineArgsId)
-        .Then([bindir](ebbrt::Future<ebbrt::EbbRef<CmdLineArgs>> f) {
+        .Then([bindir, preload, data,
+               len](ebbrt::Future<ebbrt::EbbRef<CmdLineArgs>> f) {
           f.Get();
-	  ebbrt::node_allocator->AllocateNode(bindir.string(), 1, 1);
+          if (!preload) {
+            ebbrt::node_allocator->AllocateNode(bindir.string(), 1, 1);
+            return;
+          }
+          ebbrt::EbbRef<ebbrt::DatasetFeed>(kDatasetFeedId)
+              ->Serve(data, len)
+              .Then([bindir](ebbrt::Future<void> f) {
+                f.Get();
+                ebbrt::node_allocator->AllocateNode(bindir.string(), 1, 1);
+              });
         });
   }
   c.Run();
@@ -0,0 +1,35 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef BENCH_HEAPCOUNT_H
+#define BENCH_HEAPCOUNT_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new and delete, so include it from the one
+// source file of a benchmark only.
+
+namespace bench {
+/** heap_allocs - every general heap allocation made while the benchmark
+ * runs
+ */
+std::atomic<size_t> heap_allocs{0};
+} // namespace bench
+
+void *operator new(size_t size) {
+  bench::heap_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
+
+#endif // BENCH_HEAPCOUNT_H
@@ -0,0 +1,78 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef BENCH_REQUESTS_H
+#define BENCH_REQUESTS_H
+
+#include <cstdio>
+#include <cstring>
+
+#include <ebbrt/UniqueIOBuf.h>
+
+#include "protocol_binary.h"
+
+namespace bench {
+/** MakeRequest() - build one binary request for key number key
+ */
+inline std::unique_ptr<ebbrt::MutUniqueIOBuf>
+MakeRequest(uint8_t opcode, size_t key, size_t extlen, size_t value_len) {
+  char keybuf[32];
+  auto keylen = snprintf(keybuf, sizeof(keybuf), "key:%012zu", key);
+  auto bodylen = extlen + keylen + value_len;
+  auto buf = ebbrt::MakeUniqueIOBuf(
+      sizeof(protocol_binary_request_header) + bodylen, true);
+  auto h = reinterpret_cast<protocol_binary_request_header *>(buf->MutData());
+  h->request.magic = PROTOCOL_BINARY_REQ;
+  h->request.opcode = opcode;
+  h->request.keylen = htons(keylen);
+  h->request.extlen = extlen;
+  h->request.bodylen = htonl(bodylen);
+  auto p = buf->MutData() + sizeof(protocol_binary_request_header) + extlen;
+  std::memcpy(p, keybuf, keylen);
+  std::memset(p + keylen, 'v', value_len);
+  return buf;
+}
+
+inline std::unique_ptr<ebbrt::MutUniqueIOBuf> MakeSet(size_t key,
+                                                      size_t value_len) {
+  return MakeRequest(PROTOCOL_BINARY_CMD_SETQ, key, 2 * sizeof(uint32_t),
+                     value_len);
+}
+
+inline std::unique_ptr<ebbrt::MutUniqueIOBuf> MakeGet(size_t key) {
+  return MakeRequest(PROTOCOL_BINARY_CMD_GETK, key, 0, 0);
+}
+
+/** MakeGetQuiet() - GETKQ, a multi-get burst is a run of these and a NOOP
+ */
+inline std::unique_ptr<ebbrt::MutUniqueIOBuf> MakeGetQuiet(size_t key) {
+  return MakeRequest(PROTOCOL_BINARY_CMD_GETKQ, key, 0, 0);
+}
+
+/** MakeArith() - INCREMENT or DECREMENT by delta, a miss creates the item
+ * at zero
+ */
+inline std::unique_ptr<ebbrt::MutUniqueIOBuf> MakeArith(uint8_t opcode,
+                                                        size_t key,
+                                                        uint64_t delta) {
+  // extras are <delta,initial,expiration>, all but delta left zero
+  auto buf = MakeRequest(opcode, key, 2 * sizeof(uint64_t) + sizeof(uint32_t),
+                         0);
+  auto net = __builtin_bswap64(delta);
+  std::memcpy(buf->MutData() + sizeof(protocol_binary_request_header), &net,
+              sizeof(net));
+  return buf;
+}
+
+inline std::unique_ptr<ebbrt::MutUniqueIOBuf> MakeNoop() {
+  auto buf =
+      ebbrt::MakeUniqueIOBuf(sizeof(protocol_binary_request_header), true);
+  auto h = reinterpret_cast<protocol_binary_request_header *>(buf->MutData());
+  h->request.magic = PROTOCOL_BINARY_REQ;
+  h->request.opcode = PROTOCOL_BINARY_CMD_NOOP;
+  return buf;
+}
+} // namespace bench
+
+#endif // BENCH_REQUESTS_H
@@ -0,0 +1,79 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// Counter benchmark: binary INCREMENTs against a few counters updated in
+// place. First checks that a CAS taken before an INCR and a DECR that bring
+// the counter back to its value no longer stores (EXISTS). Reports ns per
+// INCR.
+//
+#include <vector>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+
+#include "Memcached.h"
+#include "Requests.h"
+
+namespace {
+const constexpr size_t kCounters = 64;
+const constexpr size_t kIncrs = 1000000;
+
+uint16_t Status(const protocol_binary_response_header &rhead) {
+  return ntohs(rhead.response.status);
+}
+
+// gets, incr, decr, then a SET with the CAS from the gets
+bool CasSurvivesRoundTrip(ebbrt::Memcached *mc) {
+  const size_t key = kCounters;
+  protocol_binary_response_header rhead;
+  // created at zero, then a counter
+  mc->ProcessBinary(bench::MakeArith(PROTOCOL_BINARY_CMD_INCREMENT, key, 1),
+                    &rhead);
+  mc->ProcessBinary(bench::MakeArith(PROTOCOL_BINARY_CMD_DECREMENT, key, 1),
+                    &rhead);
+  mc->ProcessBinary(bench::MakeGet(key), &rhead);
+  auto cas = rhead.response.cas;
+  mc->ProcessBinary(bench::MakeArith(PROTOCOL_BINARY_CMD_INCREMENT, key, 1),
+                    &rhead);
+  mc->ProcessBinary(bench::MakeArith(PROTOCOL_BINARY_CMD_DECREMENT, key, 1),
+                    &rhead);
+  auto set = bench::MakeRequest(PROTOCOL_BINARY_CMD_SET, key,
+                                2 * sizeof(uint32_t), 1);
+  auto h = reinterpret_cast<protocol_binary_request_header *>(set->MutData());
+  h->request.cas = cas;
+  mc->ProcessBinary(std::move(set), &rhead);
+  return Status(rhead) != PROTOCOL_BINARY_RESPONSE_KEY_EEXISTS;
+}
+} // namespace
+
+void AppMain() {
+  auto mc = new ebbrt::Memcached();
+  mc->SetMemoryLimit(size_t(1) << 40);
+  if (CasSurvivesRoundTrip(mc)) {
+    ebbrt::kprintf("Counters FAILED: CAS unchanged by incr, decr\n");
+    return;
+  }
+  protocol_binary_response_header rhead;
+  for (size_t i = 0; i < kCounters; i++) {
+    mc->ProcessBinary(bench::MakeArith(PROTOCOL_BINARY_CMD_INCREMENT, i, 1),
+                      &rhead);
+  }
+  std::vector<std::unique_ptr<ebbrt::IOBuf>> reqs;
+  reqs.reserve(kIncrs);
+  for (size_t i = 0; i < kIncrs; i++) {
+    reqs.emplace_back(
+        bench::MakeArith(PROTOCOL_BINARY_CMD_INCREMENT, i % kCounters, 1));
+  }
+  auto start = ebbrt::clock::Wall::Now();
+  for (auto &req : reqs) {
+    mc->ProcessBinary(std::move(req), &rhead);
+  }
+  auto end = ebbrt::clock::Wall::Now();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+                .count();
+  ebbrt::kprintf("counters=%zu incr=%4lluns\n", kCounters,
+                 (unsigned long long)(ns / kIncrs));
+  ebbrt::kprintf("Counters done\n");
+}
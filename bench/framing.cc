@@ -0,0 +1,125 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// Framing benchmark: cuts synthetic request streams into segments the way
+// the network might deliver them and feeds them through Memcached::Framer,
+// the request splitting behind TcpSession::Receive. Reports ns and heap
+// allocations per framed request for requests that fill a segment, many
+// to a segment, split across segments, and jumbo values.
+//
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+
+#include "HeapCount.h"
+#include "Memcached.h"
+#include "Requests.h"
+
+namespace {
+const constexpr size_t kMss = 1448;
+
+std::string Bytes(std::unique_ptr<ebbrt::MutUniqueIOBuf> buf) {
+  return std::string(reinterpret_cast<const char *>(buf->Data()),
+                     buf->Length());
+}
+
+std::string BinaryGet(size_t i) { return Bytes(bench::MakeGet(i)); }
+
+std::string BinarySet4k(size_t i) { return Bytes(bench::MakeSet(i, 4096)); }
+
+std::string BinarySet256k(size_t i) {
+  return Bytes(bench::MakeSet(i, 256 * 1024));
+}
+
+std::string AsciiGet(size_t i) {
+  char line[64];
+  snprintf(line, sizeof(line), "get key:%012zu\r\n", i);
+  return line;
+}
+
+std::string AsciiSet(size_t i) {
+  char line[64];
+  snprintf(line, sizeof(line), "set key:%012zu 0 0 32\r\n", i);
+  return line + std::string(32, 'v') + "\r\n";
+}
+
+/**
+ * Pattern - a stream of count requests delivered per_segment requests to
+ * a segment or, if per_segment is zero, in segments of bytes
+ */
+struct Pattern {
+  const char *name;
+  std::string (*request)(size_t);
+  size_t count;
+  size_t per_segment;
+  size_t bytes;
+};
+
+const Pattern kPatterns[] = {
+    {"binary get, 1 per segment", BinaryGet, 100000, 1, 0},
+    {"binary get, 32 per segment", BinaryGet, 100000, 32, 0},
+    {"binary get, split in 3", BinaryGet, 100000, 0, 14},
+    {"binary set 4k, mss segments", BinarySet4k, 20000, 0, kMss},
+    {"binary set 256k, mss segments", BinarySet256k, 200, 0, kMss},
+    {"binary set 256k, 64k segments", BinarySet256k, 200, 0, 64 * 1024},
+    {"ascii get, 1 per segment", AsciiGet, 100000, 1, 0},
+    {"ascii get, 32 per segment", AsciiGet, 100000, 32, 0},
+    {"ascii get, split in 3", AsciiGet, 100000, 0, 8},
+    {"ascii set 32, 16 per segment", AsciiSet, 50000, 16, 0},
+};
+
+void Run(const Pattern &p) {
+  std::string stream;
+  for (size_t i = 0; i < p.count; i++) {
+    stream += p.request(i);
+  }
+  // every request of a pattern is the same length
+  auto segment =
+      p.per_segment ? p.per_segment * p.request(0).size() : p.bytes;
+  std::vector<std::unique_ptr<ebbrt::MutUniqueIOBuf>> segs;
+  for (size_t off = 0; off < stream.size(); off += segment) {
+    auto n = std::min(segment, stream.size() - off);
+    auto buf = ebbrt::MakeUniqueIOBuf(n);
+    std::memcpy(buf->MutData(), stream.data() + off, n);
+    segs.emplace_back(std::move(buf));
+  }
+
+  ebbrt::Memcached::Framer framer;
+  size_t framed = 0;
+  bool ascii;
+  boost::string_ref line;
+  auto allocs = bench::heap_allocs.load();
+  auto start = ebbrt::clock::Wall::Now();
+  for (auto &seg : segs) {
+    framer.Append(std::move(seg));
+    while (auto msg = framer.Next(&ascii, &line)) {
+      framed++;
+    }
+  }
+  auto end = ebbrt::clock::Wall::Now();
+  allocs = bench::heap_allocs.load() - allocs;
+  auto ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+  ebbrt::kprintf("%-32s %7zu segments %8.1f ns/request %6.2f allocs/request",
+                 p.name, segs.size(), double(ns) / p.count,
+                 double(allocs) / p.count);
+  if (framed != p.count) {
+    ebbrt::kprintf(" (framed %zu of %zu)", framed, p.count);
+  }
+  ebbrt::kprintf("\n");
+}
+} // namespace
+
+void AppMain() {
+  for (auto &p : kPatterns) {
+    Run(p);
+  }
+  ebbrt::kprintf("Framing done\n");
+}
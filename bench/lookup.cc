@@ -0,0 +1,69 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// Lookup benchmark: single GETs against a table much larger than the cache,
+// at hit ratios from 100% down to 0%. Misses draw their keys from a range
+// never stored, so most are turned away by the tags of their bucket without
+// reading an entry. Reports ns per GET at each ratio.
+//
+#include <vector>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+
+#include "Memcached.h"
+#include "Requests.h"
+
+namespace {
+const constexpr size_t kKeys = 1 << 19;
+const constexpr size_t kValueLen = 32;
+const constexpr size_t kGets = 500000;
+const size_t kHitPercents[] = {100, 75, 50, 25, 0};
+
+uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+uint64_t Random() {
+  // xorshift64
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+uint64_t Time(ebbrt::Memcached *mc, size_t hit_percent) {
+  std::vector<std::unique_ptr<ebbrt::IOBuf>> reqs;
+  reqs.reserve(kGets);
+  for (size_t i = 0; i < kGets; i++) {
+    auto key = Random() % kKeys;
+    if (Random() % 100 >= hit_percent) {
+      key += kKeys;
+    }
+    reqs.emplace_back(bench::MakeGet(key));
+  }
+  protocol_binary_response_header rhead;
+  auto start = ebbrt::clock::Wall::Now();
+  for (auto &req : reqs) {
+    mc->ProcessBinary(std::move(req), &rhead);
+  }
+  auto end = ebbrt::clock::Wall::Now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+             .count() /
+         kGets;
+}
+} // namespace
+
+void AppMain() {
+  auto mc = new ebbrt::Memcached();
+  mc->SetMemoryLimit(size_t(1) << 40);
+  protocol_binary_response_header rhead;
+  for (size_t i = 0; i < kKeys; i++) {
+    mc->ProcessBinary(bench::MakeSet(i, kValueLen), &rhead);
+  }
+  for (auto pct : kHitPercents) {
+    ebbrt::kprintf("hits=%3zu%% get=%4lluns\n", pct,
+                   (unsigned long long)Time(mc, pct));
+  }
+  ebbrt::kprintf("Lookup done\n");
+}
@@ -0,0 +1,11 @@
+#!/bin/sh
+# loopback.sh SERVER BENCH [bench options] - start the memcached-linux
+# binary SERVER on loopback, preload it and run memcached-bench against it,
+# then stop it. SERVER_CORES sets the server core count (default 2).
+server=$1
+bench=$2
+shift 2
+"$server" "${SERVER_CORES:-2}" >/dev/null &
+pid=$!
+trap 'kill $pid 2>/dev/null' EXIT INT TERM
+"$bench" --preload "$@"
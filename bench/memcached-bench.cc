@@ -0,0 +1,958 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// memcached-bench: binary protocol load generator, a Linux program meant to
+// drive memcached-linux (or any memcached) on loopback. Every thread owns
+// --conns connections and an epoll set.
+//
+// Closed loop keeps --depth requests in flight on every connection. Open
+// loop issues requests at Poisson arrivals of --rate per second overall and
+// times each one from its scheduled arrival, so a stalled server shows up
+// as latency instead of as fewer samples. Requests beyond --depth on a
+// connection wait client side.
+//
+// Keys are drawn uniformly or, with --zipf THETA, from a Zipfian popularity
+// whose ranks are scrambled over the key space. Key and value sizes take
+// N (fixed) or A-B (uniform). --preload SETs every key before the run.
+// --write-dataset FILE instead writes the same keys and values as a preload
+// file for memcached-linux --preload, without connecting.
+//
+// --udp sends the GETs over memcached's UDP transport, one request per
+// datagram on a socket beside each connection, and SETs over TCP as
+// before, so the same run with and without it compares the two paths.
+// A GET is counted lost once a later one is answered, or after 100ms.
+//
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Dataset.h"
+#include "LatencyHistogram.h"
+#include "protocol_binary.h"
+
+namespace {
+const constexpr size_t kMaxKey = 250;
+const constexpr size_t kMaxValue = 1 << 20;
+const constexpr size_t kReadSize = 64 * 1024;
+const constexpr size_t kMaxEvents = 64;
+const constexpr size_t kDatasetBlock = 1 << 20;
+const constexpr size_t kMaxDatagram = 64 * 1024;
+const constexpr uint64_t kUdpTimeout = 100000000; // ns
+// marks the epoll events of a connection's UDP socket
+const constexpr uint64_t kUdpEvent = uint64_t(1) << 32;
+enum Op { kGet = 0, kSet = 1 };
+
+/** Range - a size distribution: uniform over [lo, hi], fixed if lo == hi */
+struct Range {
+  size_t lo;
+  size_t hi;
+};
+
+struct Options {
+  std::string host{"127.0.0.1"};
+  uint16_t port{11211};
+  size_t threads{1};
+  size_t conns{4};
+  size_t depth{1};
+  double duration{10};
+  bool open{false};
+  double rate{0};
+  uint64_t keys{100000};
+  double zipf{0};
+  Range key_size{16, 16};
+  Range value_size{32, 32};
+  double get_ratio{0.9};
+  bool preload{false};
+  const char *dataset{nullptr};
+  bool udp{false};
+  uint64_t seed{1};
+};
+
+Options opts;
+char value_bytes[kMaxValue];
+
+[[noreturn]] void Fatal(const char *fmt, const char *what) {
+  std::fprintf(stderr, "memcached-bench: ");
+  std::fprintf(stderr, fmt, what);
+  std::fprintf(stderr, "\n");
+  std::exit(1);
+}
+
+uint64_t Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// 64 bit finalizer of MurmurHash3
+uint64_t Mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+size_t Digits(uint64_t n) {
+  size_t d = 1;
+  while (n >= 10) {
+    n /= 10;
+    d++;
+  }
+  return d;
+}
+
+/**
+ * FormatKey() - write key index key to buf and return its length: the
+ * index right aligned in a field of k's, the length fixed per key
+ */
+size_t FormatKey(uint64_t key, char *buf) {
+  auto &ks = opts.key_size;
+  auto len = ks.lo == ks.hi ? ks.lo : ks.lo + Mix(~key) % (ks.hi - ks.lo + 1);
+  std::memset(buf, 'k', len);
+  auto p = buf + len;
+  do {
+    *--p = '0' + key % 10;
+    key /= 10;
+  } while (key != 0);
+  return len;
+}
+
+/**
+ * Zipf - ranks 0..n-1 drawn with probability proportional to
+ * 1/(rank+1)^theta, for 0 < theta < 1, with the method of Gray et al.,
+ * "Quickly Generating Billion-Record Synthetic Databases": O(n) setup,
+ * constant time per sample.
+ */
+class Zipf {
+public:
+  Zipf(uint64_t n, double theta) : n_(n) {
+    double zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+      zetan += 1 / std::pow(double(i), theta);
+    }
+    auto zeta2 = 1 + std::pow(0.5, theta);
+    zetan_ = zetan;
+    second_ = zeta2;
+    alpha_ = 1 / (1 - theta);
+    eta_ = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+  }
+
+  template <typename Rng> uint64_t operator()(Rng &rng) const {
+    auto u = std::uniform_real_distribution<double>(0, 1)(rng);
+    auto uz = u * zetan_;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < second_) {
+      return 1;
+    }
+    auto rank = uint64_t(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    return std::min(rank, n_ - 1);
+  }
+
+private:
+  uint64_t n_;
+  double zetan_;
+  double second_;
+  double alpha_;
+  double eta_;
+};
+
+std::unique_ptr<Zipf> zipf;
+
+/** Pending - a request on the wire, answered in order */
+struct Pending {
+  uint64_t start;
+  Op op;
+};
+
+/**
+ * UdpFrame - the 8 byte header of every datagram of memcached's UDP
+ * transport, in network byte order
+ */
+struct UdpFrame {
+  uint16_t request_id;
+  uint16_t sequence;
+  uint16_t datagrams;
+  uint16_t reserved;
+};
+
+/** UdpPending - a GET sent over UDP, waiting for every reply datagram */
+struct UdpPending {
+  uint16_t request_id;
+  uint64_t sent;
+  Pending p;
+};
+
+struct Conn {
+  int fd{-1};
+  std::string out;
+  size_t out_pos{0};
+  bool want_write{false};
+  std::vector<char> in = std::vector<char>(kReadSize);
+  size_t in_len{0};
+  std::deque<Pending> inflight;
+  // open loop arrivals waiting for a free slot
+  std::deque<uint64_t> backlog;
+  // --udp: the GET socket, the GETs it has in flight and the reply
+  // datagrams gathered so far for the oldest
+  int ufd{-1};
+  uint16_t next_id{0};
+  std::deque<UdpPending> udp_inflight;
+  std::string udp_in;
+  uint16_t udp_seq{0};
+  size_t InFlight() const { return inflight.size() + udp_inflight.size(); }
+};
+
+class Worker {
+public:
+  explicit Worker(size_t id);
+  void Connect(const sockaddr_in &addr);
+  void Preload(uint64_t begin, uint64_t end);
+  void Run(uint64_t start, uint64_t deadline);
+
+  ebbrt::LatencyHistogram hist[2];
+  uint64_t completed[2] = {0, 0};
+  uint64_t hits{0};
+  uint64_t misses{0};
+  uint64_t errors{0};
+  uint64_t lost{0};
+
+private:
+  void Poll(int timeout);
+  void Issue(Conn &c, uint64_t start);
+  void Flush(Conn &c);
+  void Read(Conn &c);
+  void ReadUdp(Conn &c);
+  void ExpireUdp(Conn &c);
+  void Lost(Conn &c);
+  void OnReply(Conn &c, const Pending &p,
+               const protocol_binary_response_header &res);
+  void Next(Conn &c, uint64_t now);
+  uint64_t NextKey();
+  size_t Draw(const Range &r);
+
+  int epfd_;
+  std::vector<Conn> conns_;
+  std::mt19937_64 rng_;
+  uint64_t preload_next_{0};
+  uint64_t preload_end_{0};
+  bool measuring_{false};
+  uint64_t deadline_{0};
+};
+
+Worker::Worker(size_t id)
+    : conns_(opts.conns), rng_(opts.seed * 1000003 + id) {
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd_ < 0) {
+    Fatal("epoll_create1: %s", std::strerror(errno));
+  }
+}
+
+void Worker::Connect(const sockaddr_in &addr) {
+  for (size_t i = 0; i < conns_.size(); i++) {
+    auto &c = conns_[i];
+    // the server may still be starting up
+    for (int tries = 0;; tries++) {
+      c.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (connect(c.fd, reinterpret_cast<const sockaddr *>(&addr),
+                  sizeof(addr)) == 0) {
+        break;
+      }
+      auto err = errno;
+      close(c.fd);
+      if (err != ECONNREFUSED || tries == 50) {
+        Fatal("connect: %s", std::strerror(err));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+    if (!opts.udp) {
+      continue;
+    }
+    // the server listens for UDP on the same port
+    c.ufd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.ufd < 0 || connect(c.ufd, reinterpret_cast<const sockaddr *>(&addr),
+                             sizeof(addr)) != 0) {
+      Fatal("udp socket: %s", std::strerror(errno));
+    }
+    ev.data.u64 = i | kUdpEvent;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, c.ufd, &ev);
+  }
+}
+
+/**
+ * Preload() - SET keys [begin, end) with depth requests in flight per
+ * connection, before anything is measured
+ */
+void Worker::Preload(uint64_t begin, uint64_t end) {
+  preload_next_ = begin;
+  preload_end_ = end;
+  for (auto &c : conns_) {
+    for (size_t d = 0; d < opts.depth && preload_next_ < preload_end_; d++) {
+      Issue(c, Now());
+    }
+    Flush(c);
+  }
+  auto busy = [this]() {
+    for (auto &c : conns_) {
+      if (!c.inflight.empty()) {
+        return true;
+      }
+    }
+    return false;
+  };
+  while (busy()) {
+    Poll(10);
+  }
+}
+
+void Worker::Run(uint64_t start, uint64_t deadline) {
+  measuring_ = true;
+  deadline_ = deadline;
+  while (Now() < start) {
+  }
+  if (!opts.open) {
+    for (auto &c : conns_) {
+      for (size_t d = 0; d < opts.depth; d++) {
+        Issue(c, Now());
+      }
+      Flush(c);
+    }
+    while (Now() < deadline) {
+      Poll(1);
+    }
+    return;
+  }
+  std::exponential_distribution<double> gap(opts.rate / opts.threads / 1e9);
+  auto next = start + uint64_t(gap(rng_));
+  size_t rr = 0;
+  while (true) {
+    auto now = Now();
+    if (now >= deadline) {
+      return;
+    }
+    for (; next <= now; next += uint64_t(gap(rng_))) {
+      auto &c = conns_[rr++ % conns_.size()];
+      if (c.InFlight() < opts.depth) {
+        Issue(c, next);
+      } else {
+        c.backlog.push_back(next);
+      }
+    }
+    for (auto &c : conns_) {
+      Flush(c);
+    }
+    auto wait = std::min(next, deadline) - now;
+    Poll(wait < 1000000 ? 0 : int(wait / 1000000));
+  }
+}
+
+void Worker::Poll(int timeout) {
+  epoll_event events[kMaxEvents];
+  auto n = epoll_wait(epfd_, events, kMaxEvents, timeout);
+  if (n < 0 && errno != EINTR) {
+    Fatal("epoll_wait: %s", std::strerror(errno));
+  }
+  for (int i = 0; i < n; i++) {
+    auto &c = conns_[events[i].data.u64 & (kUdpEvent - 1)];
+    if (events[i].data.u64 & kUdpEvent) {
+      ReadUdp(c);
+      Flush(c);
+      continue;
+    }
+    if (events[i].events & EPOLLOUT) {
+      Flush(c);
+    }
+    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      Read(c);
+      Flush(c);
+    }
+  }
+  if (opts.udp) {
+    for (auto &c : conns_) {
+      ExpireUdp(c);
+      Flush(c);
+    }
+  }
+}
+
+uint64_t Worker::NextKey() {
+  if (zipf) {
+    // spread the popular ranks over the key space, and so over shards
+    return Mix((*zipf)(rng_)) % opts.keys;
+  }
+  return std::uniform_int_distribution<uint64_t>(0, opts.keys - 1)(rng_);
+}
+
+size_t Worker::Draw(const Range &r) {
+  if (r.lo == r.hi) {
+    return r.lo;
+  }
+  return std::uniform_int_distribution<size_t>(r.lo, r.hi)(rng_);
+}
+
+/** Issue() - queue one request on c, timed from start */
+void Worker::Issue(Conn &c, uint64_t start) {
+  uint64_t key;
+  Op op;
+  if (preload_next_ < preload_end_) {
+    key = preload_next_++;
+    op = kSet;
+  } else {
+    key = NextKey();
+    op = std::uniform_real_distribution<double>(0, 1)(rng_) < opts.get_ratio
+             ? kGet
+             : kSet;
+  }
+  char keybuf[kMaxKey];
+  auto keylen = FormatKey(key, keybuf);
+
+  size_t extlen = op == kSet ? 8 : 0;
+  size_t vlen = op == kSet ? Draw(opts.value_size) : 0;
+  protocol_binary_request_header h;
+  std::memset(&h, 0, sizeof(h));
+  h.request.magic = PROTOCOL_BINARY_REQ;
+  h.request.opcode = op == kSet ? PROTOCOL_BINARY_CMD_SET
+                                : PROTOCOL_BINARY_CMD_GET;
+  h.request.keylen = htons(keylen);
+  h.request.extlen = extlen;
+  h.request.bodylen = htonl(extlen + keylen + vlen);
+  if (opts.udp && op == kGet) {
+    // a datagram of its own, answered or given up on out of TCP order
+    char dgram[sizeof(UdpFrame) + sizeof(h.bytes) + kMaxKey];
+    UdpFrame frame = {htons(c.next_id), 0, htons(1), 0};
+    std::memcpy(dgram, &frame, sizeof(frame));
+    std::memcpy(dgram + sizeof(frame), h.bytes, sizeof(h.bytes));
+    std::memcpy(dgram + sizeof(frame) + sizeof(h.bytes), keybuf, keylen);
+    c.udp_inflight.push_back({frame.request_id, Now(), {start, op}});
+    c.next_id++;
+    // one the socket has no room for is lost, and times out
+    send(c.ufd, dgram, sizeof(frame) + sizeof(h.bytes) + keylen, 0);
+    return;
+  }
+  c.out.append(reinterpret_cast<const char *>(h.bytes), sizeof(h.bytes));
+  // flags and exptime, both zero
+  c.out.append(extlen, '\0');
+  c.out.append(keybuf, keylen);
+  c.out.append(value_bytes, vlen);
+  c.inflight.push_back({start, op});
+}
+
+void Worker::Flush(Conn &c) {
+  while (c.out_pos < c.out.size()) {
+    auto n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos,
+                  MSG_NOSIGNAL);
+    if (n > 0) {
+      c.out_pos += n;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      Fatal("send: %s", std::strerror(errno));
+    }
+    if (!c.want_write) {
+      c.want_write = true;
+      epoll_event ev = {};
+      ev.events = EPOLLIN | EPOLLOUT;
+      ev.data.u64 = &c - conns_.data();
+      epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+    return;
+  }
+  c.out.clear();
+  c.out_pos = 0;
+  if (c.want_write) {
+    c.want_write = false;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = &c - conns_.data();
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+  }
+}
+
+void Worker::Read(Conn &c) {
+  const auto hlen = sizeof(protocol_binary_response_header);
+  while (true) {
+    if (c.in_len == c.in.size()) {
+      c.in.resize(c.in.size() * 2);
+    }
+    auto n = recv(c.fd, c.in.data() + c.in_len, c.in.size() - c.in_len, 0);
+    if (n == 0) {
+      Fatal("%s", "server closed the connection");
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      Fatal("recv: %s", std::strerror(errno));
+    }
+    c.in_len += n;
+    size_t pos = 0;
+    while (c.in_len - pos >= hlen) {
+      protocol_binary_response_header res;
+      std::memcpy(res.bytes, c.in.data() + pos, hlen);
+      auto len = hlen + ntohl(res.response.bodylen);
+      if (c.in_len - pos < len) {
+        break;
+      }
+      if (c.inflight.empty()) {
+        Fatal("%s", "unexpected reply");
+      }
+      auto p = c.inflight.front();
+      c.inflight.pop_front();
+      OnReply(c, p, res);
+      pos += len;
+    }
+    std::memmove(c.in.data(), c.in.data() + pos, c.in_len - pos);
+    c.in_len -= pos;
+  }
+}
+
+/**
+ * ReadUdp() - gather the reply datagrams of GETs in flight on c's UDP
+ * socket. A reply missing a datagram is dropped and its GET times out.
+ */
+void Worker::ReadUdp(Conn &c) {
+  char buf[kMaxDatagram];
+  while (true) {
+    auto n = recv(c.ufd, buf, sizeof(buf), 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      Fatal("recv: %s", std::strerror(errno));
+    }
+    UdpFrame frame;
+    if (size_t(n) < sizeof(frame) || c.udp_inflight.empty()) {
+      continue;
+    }
+    std::memcpy(&frame, buf, sizeof(frame));
+    auto it = std::find_if(
+        c.udp_inflight.begin(), c.udp_inflight.end(),
+        [&frame](const UdpPending &u) {
+          return u.request_id == frame.request_id;
+        });
+    if (it == c.udp_inflight.end()) {
+      continue;
+    }
+    // replies come back in order, so the GETs sent before this one are lost
+    auto skipped = it - c.udp_inflight.begin();
+    for (decltype(skipped) i = 0; i < skipped; i++) {
+      Lost(c);
+    }
+    if (ntohs(frame.sequence) != c.udp_seq) {
+      c.udp_in.clear();
+      c.udp_seq = 0;
+      continue;
+    }
+    c.udp_in.append(buf + sizeof(frame), n - sizeof(frame));
+    if (++c.udp_seq < ntohs(frame.datagrams)) {
+      continue;
+    }
+    protocol_binary_response_header res;
+    auto whole = c.udp_in.size() >= sizeof(res.bytes);
+    if (whole) {
+      std::memcpy(res.bytes, c.udp_in.data(), sizeof(res.bytes));
+    }
+    c.udp_in.clear();
+    c.udp_seq = 0;
+    if (!whole) {
+      continue;
+    }
+    auto p = c.udp_inflight.front().p;
+    c.udp_inflight.pop_front();
+    OnReply(c, p, res);
+  }
+}
+
+/** ExpireUdp() - give up on GETs unanswered for kUdpTimeout */
+void Worker::ExpireUdp(Conn &c) {
+  auto now = Now();
+  while (!c.udp_inflight.empty() &&
+         now - c.udp_inflight.front().sent > kUdpTimeout) {
+    Lost(c);
+  }
+}
+
+/** Lost() - give up on the oldest GET in flight on c's UDP socket */
+void Worker::Lost(Conn &c) {
+  auto now = Now();
+  c.udp_inflight.pop_front();
+  c.udp_in.clear();
+  c.udp_seq = 0;
+  if (measuring_ && now < deadline_) {
+    lost++;
+  }
+  Next(c, now);
+}
+
+void Worker::OnReply(Conn &c, const Pending &p,
+                     const protocol_binary_response_header &res) {
+  if (res.response.magic != PROTOCOL_BINARY_RES) {
+    Fatal("%s", "unexpected reply");
+  }
+  auto now = Now();
+  auto status = ntohs(res.response.status);
+  if (measuring_ && now < deadline_) {
+    hist[p.op].Record(now - p.start);
+    completed[p.op]++;
+    if (p.op == kGet && status == PROTOCOL_BINARY_RESPONSE_KEY_ENOENT) {
+      misses++;
+    } else if (status != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+      errors++;
+    } else if (p.op == kGet) {
+      hits++;
+    }
+  }
+  Next(c, now);
+}
+
+/** Next() - follow a request done with c with the next one, if any */
+void Worker::Next(Conn &c, uint64_t now) {
+  if (preload_next_ < preload_end_) {
+    Issue(c, now);
+  } else if (measuring_ && now < deadline_) {
+    if (!opts.open) {
+      Issue(c, now);
+    } else if (!c.backlog.empty()) {
+      Issue(c, c.backlog.front());
+      c.backlog.pop_front();
+    }
+  }
+}
+
+Range ParseRange(const char *arg) {
+  char *end;
+  Range r;
+  r.lo = r.hi = std::strtoul(arg, &end, 10);
+  if (*end == '-') {
+    r.hi = std::strtoul(end + 1, &end, 10);
+  }
+  if (*end != '\0' || r.lo == 0 || r.hi < r.lo) {
+    Fatal("bad size '%s', expected N or A-B", arg);
+  }
+  return r;
+}
+
+void Usage() {
+  std::fprintf(
+      stderr,
+      "usage: memcached-bench [options]\n"
+      "  --host ADDR         server IPv4 address (127.0.0.1)\n"
+      "  --port PORT         server port (11211)\n"
+      "  --threads N         client threads (1)\n"
+      "  --conns N           connections per thread (4)\n"
+      "  --depth N           requests in flight per connection (1)\n"
+      "  --duration SECS     measured run time (10)\n"
+      "  --mode closed|open  closed loop, or Poisson arrivals (closed)\n"
+      "  --rate OPS          open loop arrival rate, all threads\n"
+      "  --keys N            key space (100000)\n"
+      "  --zipf THETA        Zipfian keys, 0 < THETA < 1 (uniform)\n"
+      "  --key-size N|A-B    key length in bytes (16)\n"
+      "  --value-size N|A-B  SET value length in bytes (32)\n"
+      "  --get-ratio F       fraction of GETs, the rest SETs (0.9)\n"
+      "  --preload           SET every key before the run\n"
+      "  --write-dataset F   write every key to F for memcached-linux\n"
+      "                      --preload, then exit\n"
+      "  --udp               GETs over UDP, SETs over TCP\n"
+      "  --seed N            random seed (1)\n");
+  std::exit(2);
+}
+
+void ParseOptions(int argc, char **argv) {
+  static const option longopts[] = {{"host", required_argument, 0, 'h'},
+                                    {"port", required_argument, 0, 'p'},
+                                    {"threads", required_argument, 0, 't'},
+                                    {"conns", required_argument, 0, 'c'},
+                                    {"depth", required_argument, 0, 'd'},
+                                    {"duration", required_argument, 0, 'D'},
+                                    {"mode", required_argument, 0, 'm'},
+                                    {"rate", required_argument, 0, 'r'},
+                                    {"keys", required_argument, 0, 'k'},
+                                    {"zipf", required_argument, 0, 'z'},
+                                    {"key-size", required_argument, 0, 'K'},
+                                    {"value-size", required_argument, 0, 'V'},
+                                    {"get-ratio", required_argument, 0, 'g'},
+                                    {"preload", no_argument, 0, 'P'},
+                                    {"write-dataset", required_argument, 0,
+                                     'W'},
+                                    {"udp", no_argument, 0, 'U'},
+                                    {"seed", required_argument, 0, 's'},
+                                    {"help", no_argument, 0, 'H'},
+                                    {0, 0, 0, 0}};
+  int ch;
+  while ((ch = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+    switch (ch) {
+    case 'h':
+      opts.host = optarg;
+      break;
+    case 'p':
+      opts.port = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 't':
+      opts.threads = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'c':
+      opts.conns = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'd':
+      opts.depth = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'D':
+      opts.duration = std::strtod(optarg, nullptr);
+      break;
+    case 'm':
+      if (std::strcmp(optarg, "open") == 0) {
+        opts.open = true;
+      } else if (std::strcmp(optarg, "closed") != 0) {
+        Usage();
+      }
+      break;
+    case 'r':
+      opts.rate = std::strtod(optarg, nullptr);
+      break;
+    case 'k':
+      opts.keys = std::strtoull(optarg, nullptr, 10);
+      break;
+    case 'z':
+      opts.zipf = std::strtod(optarg, nullptr);
+      break;
+    case 'K':
+      opts.key_size = ParseRange(optarg);
+      break;
+    case 'V':
+      opts.value_size = ParseRange(optarg);
+      break;
+    case 'g':
+      opts.get_ratio = std::strtod(optarg, nullptr);
+      break;
+    case 'P':
+      opts.preload = true;
+      break;
+    case 'W':
+      opts.dataset = optarg;
+      break;
+    case 'U':
+      opts.udp = true;
+      break;
+    case 's':
+      opts.seed = std::strtoull(optarg, nullptr, 10);
+      break;
+    default:
+      Usage();
+    }
+  }
+  if (optind != argc || opts.threads == 0 || opts.conns == 0 ||
+      opts.depth == 0 || opts.duration <= 0 || opts.keys < 2 ||
+      opts.get_ratio < 0 || opts.get_ratio > 1) {
+    Usage();
+  }
+  if (opts.open && opts.rate <= 0) {
+    Fatal("%s", "--mode open needs a --rate");
+  }
+  if (opts.zipf < 0 || opts.zipf >= 1) {
+    Fatal("%s", "--zipf must be in [0, 1)");
+  }
+  if (opts.key_size.hi > kMaxKey ||
+      opts.key_size.lo < Digits(opts.keys - 1)) {
+    Fatal("%s", "--key-size must fit the key index and be at most 250");
+  }
+  if (opts.value_size.hi > kMaxValue) {
+    Fatal("%s", "--value-size is at most 1MB");
+  }
+}
+
+/**
+ * WriteDataset() - write every key of the key space, with values sized as
+ * a preload would SET them, as dataset blocks of about kDatasetBlock bytes
+ */
+void WriteDataset(const char *path) {
+  auto f = std::fopen(path, "wb");
+  if (!f) {
+    Fatal("cannot create %s", path);
+  }
+  std::mt19937_64 rng(opts.seed);
+  std::string records;
+  ebbrt::DatasetBlock block = {ebbrt::kDatasetMagic, 0, 0};
+  auto flush = [&]() {
+    block.bytes = records.size();
+    if (std::fwrite(&block, sizeof(block), 1, f) != 1 ||
+        std::fwrite(records.data(), 1, records.size(), f) != records.size()) {
+      Fatal("cannot write %s", path);
+    }
+    records.clear();
+    block.records = 0;
+  };
+  auto &vs = opts.value_size;
+  for (uint64_t key = 0; key < opts.keys; key++) {
+    char keybuf[kMaxKey];
+    ebbrt::DatasetRecord r = {};
+    r.key_len = FormatKey(key, keybuf);
+    r.value_len = vs.lo;
+    if (vs.lo != vs.hi) {
+      r.value_len = std::uniform_int_distribution<size_t>(vs.lo, vs.hi)(rng);
+    }
+    records.append(reinterpret_cast<const char *>(&r), sizeof(r));
+    records.append(keybuf, r.key_len);
+    records.append(value_bytes, r.value_len);
+    block.records++;
+    if (records.size() >= kDatasetBlock) {
+      flush();
+    }
+  }
+  if (block.records > 0) {
+    flush();
+  }
+  if (std::fclose(f) != 0) {
+    Fatal("cannot write %s", path);
+  }
+  std::printf("memcached-bench: wrote %llu keys to %s\n",
+              (unsigned long long)opts.keys, path);
+}
+
+void Report(const std::vector<std::unique_ptr<Worker>> &workers) {
+  ebbrt::LatencyHistogram hist[2];
+  uint64_t completed[2] = {0, 0};
+  uint64_t hits = 0, misses = 0, errors = 0, lost = 0;
+  for (auto &w : workers) {
+    for (int op = kGet; op <= kSet; op++) {
+      hist[op].Merge(w->hist[op]);
+      completed[op] += w->completed[op];
+    }
+    hits += w->hits;
+    misses += w->misses;
+    errors += w->errors;
+    lost += w->lost;
+  }
+  auto fmt_size = [](const Range &r) {
+    return r.lo == r.hi ? std::to_string(r.lo)
+                        : std::to_string(r.lo) + "-" + std::to_string(r.hi);
+  };
+  std::printf("memcached-bench: %s:%u, %zu threads x %zu conns, depth %zu, ",
+              opts.host.c_str(), opts.port, opts.threads, opts.conns,
+              opts.depth);
+  if (opts.open) {
+    std::printf("open loop at %.0f ops/s", opts.rate);
+  } else {
+    std::printf("closed loop");
+  }
+  std::printf(", %.1f s%s\n", opts.duration,
+              opts.udp ? ", gets over udp" : "");
+  std::printf("  %llu keys %s", (unsigned long long)opts.keys,
+              opts.zipf > 0 ? "zipf" : "uniform");
+  if (opts.zipf > 0) {
+    std::printf(" %.2f", opts.zipf);
+  }
+  std::printf(", key %s B, value %s B, get ratio %.2f\n",
+              fmt_size(opts.key_size).c_str(),
+              fmt_size(opts.value_size).c_str(), opts.get_ratio);
+  auto total = completed[kGet] + completed[kSet];
+  auto lookups = hits + misses;
+  std::printf("  throughput %.0f ops/s (get %.0f, set %.0f), "
+              "get hit ratio %.2f%%, errors %llu\n",
+              total / opts.duration, completed[kGet] / opts.duration,
+              completed[kSet] / opts.duration,
+              lookups ? 100.0 * hits / lookups : 0.0,
+              (unsigned long long)errors);
+  if (opts.udp) {
+    std::printf("  udp gets lost %llu\n", (unsigned long long)lost);
+  }
+  std::printf("  %-4s %10s %9s %9s %9s %9s %9s  (us)\n", "op", "count", "p50",
+              "p90", "p99", "p99.9", "max");
+  const char *names[] = {"get", "set"};
+  for (int op = kGet; op <= kSet; op++) {
+    auto &h = hist[op];
+    std::printf("  %-4s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", names[op],
+                (unsigned long long)h.Count(), h.Percentile(50) / 1e3,
+                h.Percentile(90) / 1e3, h.Percentile(99) / 1e3,
+                h.Percentile(99.9) / 1e3, h.Max() / 1e3);
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  ParseOptions(argc, argv);
+  std::memset(value_bytes, 'v', sizeof(value_bytes));
+  if (opts.dataset) {
+    WriteDataset(opts.dataset);
+    return 0;
+  }
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(opts.port);
+  if (inet_pton(AF_INET, opts.host.c_str(), &addr.sin_addr) != 1) {
+    Fatal("bad address '%s'", opts.host.c_str());
+  }
+  if (opts.zipf > 0) {
+    zipf.reset(new Zipf(opts.keys, opts.zipf));
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (size_t i = 0; i < opts.threads; i++) {
+    workers.emplace_back(new Worker(i));
+    workers.back()->Connect(addr);
+  }
+
+  auto parallel = [&workers](std::function<void(size_t)> body) {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers.size(); i++) {
+      threads.emplace_back(body, i);
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+  };
+  if (opts.preload) {
+    parallel([&workers](size_t i) {
+      auto n = opts.keys;
+      workers[i]->Preload(n * i / opts.threads, n * (i + 1) / opts.threads);
+    });
+  }
+  // give every thread time to start before the clock does
+  auto start = Now() + 10000000;
+  auto deadline = start + uint64_t(opts.duration * 1e9);
+  parallel([&workers, start, deadline](size_t i) {
+    workers[i]->Run(start, deadline);
+  });
+  Report(workers);
+}
@@ -0,0 +1,90 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// Multi-get benchmark: GETKQ...GETKQ+NOOP bursts of 1 to 100 keys drawn at
+// random from a table much larger than the cache. Each burst is executed
+// once request by request, as Receive did before batching, and once through
+// Memcached::ProcessBinaryBatch, which prefetches every key up front.
+// Reports the cost per key of both, and the buffers the replies of a burst
+// go out in and allocate.
+//
+#include <vector>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+
+#include "Memcached.h"
+#include "Requests.h"
+
+namespace {
+const constexpr size_t kKeys = 1 << 19;
+const constexpr size_t kValueLen = 32;
+const constexpr size_t kKeysPerRun = 200000;
+const size_t kBatchSizes[] = {1, 2, 4, 8, 16, 32, 64, 100};
+
+uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+size_t RandomKey() {
+  // xorshift64
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state % kKeys;
+}
+
+// Burst of n GETKQ followed by a NOOP
+void MakeBurst(std::vector<std::unique_ptr<ebbrt::IOBuf>> &reqs, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    reqs.emplace_back(bench::MakeGetQuiet(RandomKey()));
+  }
+  reqs.emplace_back(bench::MakeNoop());
+}
+
+uint64_t Time(ebbrt::Memcached *mc, size_t n, bool batched,
+              ebbrt::Memcached::ReplyCounts *counts) {
+  auto bursts = kKeysPerRun / n;
+  std::vector<std::unique_ptr<ebbrt::IOBuf>> reqs;
+  reqs.reserve(bursts * (n + 1));
+  for (size_t i = 0; i < bursts; i++) {
+    MakeBurst(reqs, n);
+  }
+  ebbrt::Memcached::ReplyBuilder reply;
+  auto start = ebbrt::clock::Wall::Now();
+  for (size_t i = 0; i < reqs.size(); i += n + 1) {
+    if (batched) {
+      mc->ProcessBinaryBatch(&reqs[i], n + 1, reply);
+    } else {
+      for (size_t j = i; j < i + n + 1; j++) {
+        mc->ProcessBinaryBatch(&reqs[j], 1, reply);
+      }
+    }
+    reply.Finish(counts);
+  }
+  auto end = ebbrt::clock::Wall::Now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+             .count() /
+         (bursts * n);
+}
+} // namespace
+
+void AppMain() {
+  auto mc = new ebbrt::Memcached();
+  mc->SetMemoryLimit(size_t(1) << 40);
+  protocol_binary_response_header rhead;
+  for (size_t i = 0; i < kKeys; i++) {
+    mc->ProcessBinary(bench::MakeSet(i, kValueLen), &rhead);
+  }
+  for (auto n : kBatchSizes) {
+    ebbrt::Memcached::ReplyCounts counts;
+    auto serial = Time(mc, n, false, nullptr);
+    auto batched = Time(mc, n, true, &counts);
+    auto bursts = double(kKeysPerRun / n);
+    ebbrt::kprintf("keys=%3zu serial=%4lluns/key batched=%4lluns/key "
+                   "segments=%.2f/burst allocs=%.2f/burst\n",
+                   n, (unsigned long long)serial, (unsigned long long)batched,
+                   counts.segments / bursts, counts.allocs / bursts);
+  }
+  ebbrt::kprintf("MultiGet done\n");
+}
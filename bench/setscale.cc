@@ -0,0 +1,86 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// SET scaling benchmark: every participating core inserts its own disjoint
+// set of new keys through Memcached::ProcessBinary at the same time. Reports
+// aggregate SET throughput against core count, for a single shard (one
+// global insert lock) and for the lock striped store.
+//
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+#include <ebbrt/native/Cpu.h>
+#include <ebbrt/native/EventManager.h>
+
+#include "Memcached.h"
+#include "Requests.h"
+
+namespace {
+const constexpr size_t kOpsPerCore = 50000;
+const constexpr size_t kValueLen = 32;
+const constexpr size_t kShardsPerCore = 4;
+
+void Run(size_t shards, size_t ncores) {
+  auto mc = new ebbrt::Memcached();
+  mc->SetShards(shards);
+  mc->SetMemoryLimit(size_t(1) << 40);
+
+  std::vector<std::vector<std::unique_ptr<ebbrt::MutUniqueIOBuf>>> reqs(
+      ncores);
+  for (size_t c = 0; c < ncores; c++) {
+    reqs[c].reserve(kOpsPerCore);
+    for (size_t i = 0; i < kOpsPerCore; i++) {
+      reqs[c].emplace_back(bench::MakeSet(c * kOpsPerCore + i, kValueLen));
+    }
+  }
+
+  std::vector<uint64_t> elapsed(ncores);
+  std::atomic<size_t> ready{0};
+  std::atomic<size_t> done{0};
+  std::atomic<bool> go{false};
+  auto worker = [&](size_t c) {
+    ready.fetch_add(1);
+    while (!go.load()) {
+    }
+    protocol_binary_response_header rhead;
+    auto start = ebbrt::clock::Wall::Now();
+    for (auto &req : reqs[c]) {
+      mc->ProcessBinary(std::move(req), &rhead);
+    }
+    auto end = ebbrt::clock::Wall::Now();
+    elapsed[c] =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+    done.fetch_add(1);
+  };
+  for (size_t c = 1; c < ncores; c++) {
+    ebbrt::event_manager->SpawnRemote([&worker, c]() { worker(c); }, c);
+  }
+  while (ready.load() < ncores - 1) {
+  }
+  go.store(true);
+  worker(0);
+  while (done.load() < ncores) {
+  }
+
+  auto slowest = *std::max_element(elapsed.begin(), elapsed.end());
+  auto mops = double(ncores * kOpsPerCore) * 1000 / slowest;
+  ebbrt::kprintf("shards=%4zu cores=%3zu %.2f MSET/s\n", shards, ncores, mops);
+}
+} // namespace
+
+void AppMain() {
+  auto ncpus = ebbrt::Cpu::Count();
+  for (size_t ncores = 1;; ncores = std::min(ncores * 2, ncpus)) {
+    Run(1, ncores);
+    Run(ncpus * kShardsPerCore, ncores);
+    if (ncores == ncpus)
+      break;
+  }
+  ebbrt::kprintf("setscale done\n");
+}
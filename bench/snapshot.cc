@@ -0,0 +1,78 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// Snapshot benchmark: stores a million items by replaying binary SETs,
+// writes them out with Memcached::WriteSnapshot and loads the snapshot into
+// a fresh store with Memcached::LoadSnapshot. Reports the time per million
+// items of the replay, the write and the load, for 32 and 256 byte values.
+//
+#include <string>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+
+#include "Memcached.h"
+#include "Requests.h"
+
+namespace {
+const constexpr size_t kItems = 1000000;
+const size_t kValueSizes[] = {32, 256};
+
+// ns per item since start, which is also ms per million items
+double MsPerMillion(ebbrt::clock::Wall::time_point start, size_t items) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                ebbrt::clock::Wall::Now() - start)
+                .count();
+  return double(ns) / items;
+}
+
+void Run(size_t i);
+
+void Load(size_t i, double replay, double write,
+          std::unique_ptr<std::string> snapshot, size_t written) {
+  auto fresh = new ebbrt::Memcached();
+  fresh->SetMemoryLimit(size_t(1) << 40);
+  size_t loaded;
+  auto start = ebbrt::clock::Wall::Now();
+  auto ok = fresh->LoadSnapshot(snapshot->data(), snapshot->size(), &loaded);
+  auto load = MsPerMillion(start, kItems);
+  ebbrt::kprintf("value=%4zu items=%zu snapshot=%zuMB replay=%.0fms/M "
+                 "write=%.0fms/M load=%.0fms/M%s\n",
+                 kValueSizes[i], loaded, snapshot->size() >> 20, replay,
+                 write, load, ok && loaded == written ? "" : " (short)");
+  Run(i + 1);
+}
+
+void Run(size_t i) {
+  if (i == sizeof(kValueSizes) / sizeof(kValueSizes[0])) {
+    ebbrt::kprintf("Snapshot done\n");
+    return;
+  }
+  auto mc = new ebbrt::Memcached();
+  mc->SetMemoryLimit(size_t(1) << 40);
+  protocol_binary_response_header rhead;
+  auto start = ebbrt::clock::Wall::Now();
+  for (size_t k = 0; k < kItems; k++) {
+    mc->ProcessBinary(bench::MakeSet(k, kValueSizes[i]), &rhead);
+  }
+  auto replay = MsPerMillion(start, kItems);
+
+  auto snapshot = new std::string();
+  start = ebbrt::clock::Wall::Now();
+  mc->WriteSnapshot(
+      [snapshot](std::unique_ptr<ebbrt::IOBuf> chunk) {
+        for (auto &buf : *chunk) {
+          snapshot->append(reinterpret_cast<const char *>(buf.Data()),
+                           buf.Length());
+        }
+      },
+      [i, replay, start, snapshot](size_t items) {
+        Load(i, replay, MsPerMillion(start, kItems),
+             std::unique_ptr<std::string>(snapshot), items);
+      });
+}
+} // namespace
+
+void AppMain() { Run(0); }
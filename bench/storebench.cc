@@ -0,0 +1,67 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// Store benchmark: feeds binary SET requests straight into
+// Memcached::ProcessBinary and reports heap allocations per SET and latency
+// percentiles, once through the slab allocator and once with it bypassed.
+//
+#include <algorithm>
+#include <vector>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+
+#include "HeapCount.h"
+#include "Memcached.h"
+#include "Requests.h"
+
+namespace {
+const constexpr size_t kOps = 100000;
+const constexpr size_t kKeys = 20000; // later passes overwrite
+const size_t kValueSizes[] = {32, 512, 4096};
+
+void Run(const char *mode, bool bypass, size_t value_len) {
+  auto mc = new ebbrt::Memcached();
+  mc->SetMemoryLimit(size_t(1) << 40);
+  mc->SetSlabBypass(bypass);
+
+  std::vector<std::unique_ptr<ebbrt::MutUniqueIOBuf>> reqs;
+  reqs.reserve(kOps);
+  for (size_t i = 0; i < kOps; i++) {
+    reqs.emplace_back(bench::MakeSet(i % kKeys, value_len));
+  }
+
+  std::vector<uint64_t> lat;
+  lat.reserve(kOps);
+  protocol_binary_response_header rhead;
+  auto allocs = bench::heap_allocs.load();
+  for (auto &req : reqs) {
+    auto start = ebbrt::clock::Wall::Now();
+    mc->ProcessBinary(std::move(req), &rhead);
+    auto end = ebbrt::clock::Wall::Now();
+    lat.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+  }
+  allocs = bench::heap_allocs.load() - allocs;
+
+  std::sort(lat.begin(), lat.end());
+  auto slab = mc->GetSlabStats();
+  ebbrt::kprintf("%-6s value=%5zu allocs/SET=%.2f slab_allocs/SET=%.2f "
+                 "p50=%lluns p99=%lluns\n",
+                 mode, value_len, double(allocs) / kOps,
+                 double(slab.allocs) / kOps,
+                 (unsigned long long)lat[kOps / 2],
+                 (unsigned long long)lat[kOps * 99 / 100]);
+}
+} // namespace
+
+void AppMain() {
+  for (auto value_len : kValueSizes) {
+    Run("heap", true, value_len);
+    Run("slab", false, value_len);
+  }
+  ebbrt::kprintf("StoreBench done\n");
+}
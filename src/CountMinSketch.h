@@ -0,0 +1,65 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef COUNTMINSKETCH_H
+#define COUNTMINSKETCH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace ebbrt {
+/**
+ * CountMinSketch - approximate counts of hashed keys in kRows rows of
+ * kWidth saturating counters. A key bumps one counter per row, each picked
+ * by its own 16 bits of the remixed hash, and is estimated by the smallest
+ * of them, which never undercounts. Decay() halves every counter so the
+ * estimates follow recent traffic. Not thread safe: each core keeps its
+ * own.
+ */
+class CountMinSketch {
+public:
+  static const constexpr size_t kRows = 4;
+  static const constexpr size_t kWidthBits = 10;
+  static const constexpr size_t kWidth = size_t(1) << kWidthBits;
+
+  /** Add() - count hash once more and return its estimate */
+  uint32_t Add(uint64_t hash) {
+    auto h = Mix(hash);
+    uint32_t est = UINT16_MAX;
+    for (size_t r = 0; r < kRows; r++, h >>= 16) {
+      auto &c = counts_[r][h & (kWidth - 1)];
+      if (c < UINT16_MAX) {
+        c++;
+      }
+      est = std::min<uint32_t>(est, c);
+    }
+    return est;
+  }
+
+  void Decay() {
+    for (auto &row : counts_) {
+      for (auto &c : row) {
+        c >>= 1;
+      }
+    }
+  }
+
+private:
+  // the finalizer of MurmurHash3, so every row sees well mixed bits
+  static uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  static_assert(kWidthBits <= 16, "a row index is 16 bits of the hash");
+  uint16_t counts_[kRows][kWidth] = {};
+};
+} // namespace ebbrt
+
+#endif // COUNTMINSKETCH_H
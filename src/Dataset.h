@@ -0,0 +1,38 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstdint>
+
+namespace ebbrt {
+/**
+ * DatasetBlock, DatasetRecord - the bulk preload format, in host byte
+ * order. A dataset is a stream of blocks, each a DatasetBlock and the
+ * records it holds, so a loader can hop from block to block and hand whole
+ * blocks to different cores without reading the records in between. A
+ * record is a DatasetRecord followed by the key and the value, unaligned.
+ */
+struct DatasetBlock {
+  uint32_t magic;
+  uint32_t records;
+  // bytes of records following the header
+  uint64_t bytes;
+};
+
+struct DatasetRecord {
+  uint32_t value_len;
+  uint32_t flags;
+  // as in a SET: relative up to 30 days, absolute beyond, zero for never
+  uint32_t exptime;
+  uint16_t key_len;
+  uint16_t reserved;
+};
+
+// "DBLK"
+const constexpr uint32_t kDatasetMagic = 0x4b4c4244;
+} // namespace ebbrt
+
+#endif // DATASET_H
@@ -0,0 +1,123 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "DatasetFeed.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <ebbrt/GlobalIdMap.h>
+#include <ebbrt/StaticIOBuf.h>
+#include <ebbrt/UniqueIOBuf.h>
+
+#include "Dataset.h"
+#include "StaticEbbIds.h"
+
+ebbrt::DatasetFeed::DatasetFeed() : Messagable<DatasetFeed>(kDatasetFeedId) {}
+
+#ifndef __ebbrt__
+ebbrt::Future<void> ebbrt::DatasetFeed::Serve(const void *data, size_t len) {
+  data_ = static_cast<const uint8_t *>(data);
+  len_ = len;
+  return global_id_map->Set(kDatasetFeedId,
+                            messenger->LocalNetworkId().ToBytes());
+}
+
+/**
+ * ReceiveMessage() - send the node the blocks from the offset it asks for.
+ * The data goes out by reference. A malformed block is sent as is, up to
+ * kChunkBytes, for the node to stop at.
+ */
+void ebbrt::DatasetFeed::ReceiveMessage(Messenger::NetworkId nid,
+                                        std::unique_ptr<IOBuf> &&buf) {
+  if (buf->ComputeChainDataLength() < sizeof(Header)) {
+    return;
+  }
+  auto h = buf->GetDataPointer().Get<Header>();
+  auto offset = std::min<uint64_t>(h.offset, len_);
+  auto end = offset;
+  while (end < len_) {
+    DatasetBlock b;
+    if (len_ - end < sizeof(b)) {
+      break;
+    }
+    std::memcpy(&b, data_ + end, sizeof(b));
+    if (b.magic != kDatasetMagic || b.bytes > len_ - end - sizeof(b)) {
+      break;
+    }
+    auto next = end + sizeof(b) + b.bytes;
+    if (end > offset && next - offset > kChunkBytes) {
+      break;
+    }
+    end = next;
+  }
+  if (end == offset) {
+    end = std::min<uint64_t>(len_, offset + kChunkBytes);
+  }
+  auto reply = MakeUniqueIOBuf(sizeof(Header));
+  auto rh = reinterpret_cast<Header *>(reply->MutData());
+  rh->offset = offset;
+  if (end > offset) {
+    reply->PrependChain(
+        IOBuf::Create<StaticIOBuf>(data_ + offset, end - offset));
+  }
+  SendMessage(nid, std::move(reply));
+}
+#else
+void ebbrt::DatasetFeed::Load(EbbRef<Memcached> mc,
+                              std::function<void(size_t, bool)> done) {
+  mc_ = mc;
+  done_ = std::move(done);
+  items_ = 0;
+  // the launcher published its network id under ours in Serve()
+  global_id_map->Get(kDatasetFeedId).Then([this](Future<std::string> f) {
+    launcher_ = Messenger::NetworkId(f.Get());
+    Request(0);
+  });
+}
+
+void ebbrt::DatasetFeed::Request(uint64_t offset) {
+  auto buf = MakeUniqueIOBuf(sizeof(Header));
+  auto h = reinterpret_cast<Header *>(buf->MutData());
+  h->offset = offset;
+  SendMessage(launcher_, std::move(buf));
+}
+
+/**
+ * ReceiveMessage() - store a chunk from the launcher, then ask for the one
+ * after it
+ */
+void ebbrt::DatasetFeed::ReceiveMessage(Messenger::NetworkId nid,
+                                        std::unique_ptr<IOBuf> &&buf) {
+  auto h = buf->GetDataPointer().Get<Header>();
+  auto len = buf->ComputeChainDataLength() - sizeof(Header);
+  if (len == 0) {
+    done_(items_, true);
+    return;
+  }
+  buf->AdvanceChain(sizeof(Header));
+  if (buf->Length() == len) {
+    chunk_ = std::move(buf);
+  } else {
+    // Preload() takes the blocks in one piece
+    auto copy = MakeUniqueIOBuf(len);
+    auto dst = copy->MutData();
+    for (auto &b : *buf) {
+      std::memcpy(dst, b.Data(), b.Length());
+      dst += b.Length();
+    }
+    chunk_ = std::move(copy);
+  }
+  auto next = h.offset + len;
+  mc_->Preload(chunk_->Data(), len, [this, next](size_t items, bool ok) {
+    chunk_.reset();
+    items_ += items;
+    if (!ok) {
+      done_(items_, false);
+      return;
+    }
+    Request(next);
+  });
+}
+#endif
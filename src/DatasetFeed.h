@@ -0,0 +1,69 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef DATASETFEED_H
+#define DATASETFEED_H
+
+#include <functional>
+
+#include <ebbrt/Future.h>
+#include <ebbrt/Message.h>
+#include <ebbrt/StaticSharedEbb.h>
+
+#ifdef __ebbrt__
+#include "Memcached.h"
+#endif
+
+namespace ebbrt {
+/**
+ * DatasetFeed - carries a --preload dataset (see DatasetBlock) from the
+ * hosted launcher, which has the file, to the native node, which stores
+ * it. The node asks for the data from an offset on and the launcher
+ * answers with the whole blocks that fit kChunkBytes, at least one, or
+ * with no data past the end. One chunk is in flight at a time, so the node
+ * holds no more of the dataset than it is storing.
+ */
+class DatasetFeed : public StaticSharedEbb<DatasetFeed>,
+                    public Messagable<DatasetFeed> {
+public:
+  DatasetFeed();
+#ifndef __ebbrt__
+  /** Serve() - answer the node from data, e.g. a mapped file that outlives
+   * the launcher's event loop. Resolves once the node can find us.
+   */
+  Future<void> Serve(const void *data, size_t len);
+#else
+  /** Load() - fetch the dataset chunk by chunk and Memcached::Preload()
+   * each into mc. done is called with the items stored once the launcher
+   * has no more data, or ok false at the first malformed block.
+   */
+  void Load(EbbRef<Memcached> mc,
+            std::function<void(size_t items, bool ok)> done);
+#endif
+  void ReceiveMessage(Messenger::NetworkId nid, std::unique_ptr<IOBuf> &&buf);
+
+private:
+  // leads every message: the offset asked for, or that the data is from
+  struct Header {
+    uint64_t offset;
+  };
+
+#ifndef __ebbrt__
+  const uint8_t *data_{nullptr};
+  size_t len_{0};
+#else
+  void Request(uint64_t offset);
+  Messenger::NetworkId launcher_;
+  EbbRef<Memcached> mc_;
+  std::function<void(size_t, bool)> done_;
+  // the chunk being stored, in one buffer
+  std::unique_ptr<IOBuf> chunk_;
+  size_t items_{0};
+#endif
+
+  static const constexpr size_t kChunkBytes = 1 << 20;
+};
+} // namespace ebbrt
+
+#endif // DATASETFEED_H
@@ -0,0 +1,39 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef KEYREF_H
+#define KEYREF_H
+
+#include <cstddef>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "XxHash.h"
+
+namespace ebbrt {
+/**
+ * KeyRef - a request key and its hash, computed once and carried through
+ * shard selection, lookup and insert. The bytes are borrowed from the
+ * request buffer, so nothing is allocated unless a new entry is stored.
+ */
+struct KeyRef {
+  // longest key the protocol allows
+  static const constexpr size_t kMaxLength = 250;
+
+  // XXH64 of the key bytes; the table keeps it with every entry
+  struct Hash {
+    size_t operator()(const boost::string_ref &key) const {
+      return XxHash64::Hash(key.data(), key.size());
+    }
+  };
+
+  KeyRef() : hash(0) {}
+  explicit KeyRef(boost::string_ref key) : key(key), hash(Hash()(key)) {}
+
+  boost::string_ref key;
+  size_t hash;
+};
+} // namespace ebbrt
+
+#endif // KEYREF_H
@@ -0,0 +1,99 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace ebbrt {
+/**
+ * LatencyHistogram - log-linear histogram of nanosecond samples in the
+ * manner of HdrHistogram. Every power of two is split into kSubBuckets
+ * linear buckets, so a sample is placed within 1/kSubBuckets of its value
+ * with a count-leading-zeros and a shift. Samples past 2^kMaxBits ns land
+ * in the last bucket. Not thread safe: each core records into its own and
+ * readers Merge() them.
+ */
+class LatencyHistogram {
+public:
+  static const constexpr size_t kSubBits = 4;
+  static const constexpr size_t kSubBuckets = size_t(1) << kSubBits;
+  // about 68 seconds
+  static const constexpr size_t kMaxBits = 36;
+  static const constexpr size_t kBuckets =
+      (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  void Record(uint64_t ns) {
+    counts_[Index(ns)]++;
+    total_++;
+    if (ns > max_) {
+      max_ = ns;
+    }
+  }
+
+  void Merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < kBuckets; i++) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  uint64_t Count() const { return total_; }
+  uint64_t Max() const { return max_; }
+
+  /** Percentile() - the value at or below which p percent of the samples
+   * fall, rounded up to the end of its bucket
+   */
+  uint64_t Percentile(double p) const {
+    if (total_ == 0) {
+      return 0;
+    }
+    auto target = uint64_t(total_ * p / 100);
+    if (target == 0) {
+      target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+      seen += counts_[i];
+      if (seen >= target) {
+        return std::min(UpperBound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+private:
+  static size_t Index(uint64_t ns) {
+    if (ns < kSubBuckets) {
+      return ns;
+    }
+    size_t bits = 63 - __builtin_clzll(ns);
+    if (bits >= kMaxBits) {
+      return kBuckets - 1;
+    }
+    // ns >> shift is in [kSubBuckets, 2 * kSubBuckets)
+    auto shift = bits - kSubBits;
+    return shift * kSubBuckets + (ns >> shift);
+  }
+
+  static uint64_t UpperBound(size_t index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    auto shift = index / kSubBuckets - 1;
+    auto low = uint64_t(kSubBuckets + index % kSubBuckets) << shift;
+    return low + (uint64_t(1) << shift) - 1;
+  }
+
+  uint64_t counts_[kBuckets] = {};
+  uint64_t total_{0};
+  uint64_t max_{0};
+};
+} // namespace ebbrt
+
+#endif // LATENCYHISTOGRAM_H
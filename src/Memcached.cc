@@ -3,325 +3,2812 @@
 //    (See accompanying file LICENSE_1_0.txt or copy at
 //          http://www.boost.org/LICENSE_1_0.txt)
 //
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <ebbrt/SharedIOBufRef.h>
+#include <ebbrt/StaticIOBuf.h>
 #include <ebbrt/UniqueIOBuf.h>
+#include <ebbrt/native/Clock.h>
 
 #include "Memcached.h"
+#include "Dataset.h"
 
-ebbrt::Memcached::Memcached() {}
+ebbrt::Memcached::Memcached() : start_time_(CurrentTime()) {
+  auto now = start_time_;
+  for (size_t i = 0; i < Cpu::Count(); i++) {
+    cores_.emplace_back(new CoreStore(this, now));
+    cores_.back()->load.tick_time = clock::Wall::Now();
+  }
+  SetShards(1);
+}
+
+void ebbrt::Memcached::SetMemoryLimit(size_t bytes) { memory_limit_ = bytes; }
+
+void ebbrt::Memcached::SetShards(size_t n) {
+  size_t bits = 0;
+  while ((size_t(1) << bits) < n) {
+    bits++;
+  }
+  // keep the total initial bucket count, but no shard under 64 buckets
+  size_t table_bits = bits + 6 < kTableBits ? kTableBits - bits : 6;
+  shards_.clear();
+  for (size_t i = 0; i < (size_t(1) << bits); i++) {
+    shards_.emplace_back(new Shard(table_bits));
+  }
+  shard_mask_ = (size_t(1) << bits) - 1;
+}
+
+void ebbrt::Memcached::SetReportInterval(std::chrono::seconds interval) {
+  report_interval_ = interval;
+}
+
+ebbrt::Memcached::Usage ebbrt::Memcached::GetUsage() const {
+  // Counters are read racily, the totals are approximate by design
+  Usage u = {};
+  for (auto &core : cores_) {
+    auto &stats = core->stats;
+    u.hits += stats.hits;
+    u.misses += stats.misses;
+    u.evictions += stats.evictions;
+    u.sets += stats.sets;
+    u.set_bytes += stats.set_bytes;
+    u.total_connections += stats.conns_opened;
+    // one core's difference can be negative, the sum over all is not
+    u.curr_connections += stats.conns_opened - stats.conns_closed;
+    u.bytes_read += stats.bytes_read;
+    u.bytes_written += stats.bytes_written;
+    u.replies += stats.replies.replies;
+    u.reply_segments += stats.replies.segments;
+    u.reply_allocs += stats.replies.allocs;
+    u.udp_received += stats.udp_received;
+    u.udp_sent += stats.udp_sent;
+    u.udp_dropped += stats.udp_dropped;
+    for (size_t i = 0; i <= PROTOCOL_BINARY_CMD_PREPENDQ; i++) {
+      u.cmds[i] += stats.cmds[i];
+    }
+    u.items += core->items;
+    u.resident_bytes += core->resident_bytes.load(std::memory_order_relaxed);
+    u.held_bytes += core->held_bytes.load(std::memory_order_relaxed);
+    u.replica_hits += stats.replica_hits;
+    u.replica_copies += stats.replica_copies;
+    {
+      std::lock_guard<ebbrt::SpinLock> guard(core->lock);
+      u.hot_keys += core->hot.size();
+    }
+  }
+  if (u.curr_connections > u.total_connections) {
+    // a close counted before the open it matches
+    u.curr_connections = 0;
+  }
+  u.limit_bytes = memory_limit_;
+  size_t linked = 0;
+  for (auto &shard : shards_) {
+    u.buckets += shard->table.bucket_count();
+    linked += shard->table.size();
+  }
+  u.load_factor = double(linked) / u.buckets;
+  return u;
+}
+
+void ebbrt::Memcached::ReportUsage() const {
+  auto u = GetUsage();
+  auto lookups = u.hits + u.misses;
+  auto hit_pct = lookups ? (u.hits * 100) / lookups : 0;
+  kprintf("memcached: items=%zu resident=%zu/%zu bytes held=%zu bytes "
+          "hits=%llu misses=%llu hit_rate=%llu%% evictions=%llu buckets=%zu "
+          "load_factor=%.2f\n",
+          u.items, u.resident_bytes, u.limit_bytes, u.held_bytes,
+          (unsigned long long)u.hits, (unsigned long long)u.misses,
+          (unsigned long long)hit_pct, (unsigned long long)u.evictions,
+          u.buckets, u.load_factor);
+  std::string util;
+  for (auto &core : cores_) {
+    util += " " +
+            std::to_string(core->load.utilization.load(
+                               std::memory_order_relaxed) /
+                           10) +
+            "%";
+  }
+  kprintf("memcached: core utilization%s\n", util.c_str());
+}
 
 ebbrt::Memcached::GetResponse::GetResponse() {}
 
-ebbrt::Memcached::GetResponse::GetResponse(std::unique_ptr<IOBuf> b) {
-    binary_response_.store(CreateBinaryResponse(std::move(b)).release());
+ebbrt::Memcached::GetResponse::~GetResponse() {
+  delete binary_response_.load(std::memory_order_relaxed);
+}
+
+namespace {
+// Take shared ownership of each buffer of a chain: the first one becomes a
+// T constructed with args, the rest MutSharedIOBufRefs linked behind it
+template <typename T, typename... Args>
+std::unique_ptr<T> ShareChain(std::unique_ptr<ebbrt::IOBuf> chain,
+                              Args &&... args) {
+  auto rest = chain->Pop();
+  auto ret = ebbrt::IOBuf::Create<T>(std::forward<Args>(args)...,
+                                     ebbrt::SharedIOBufRef::CloneView,
+                                     std::move(chain));
+  while (rest) {
+    auto next = rest->Pop();
+    ret->PrependChain(ebbrt::IOBuf::Create<ebbrt::MutSharedIOBufRef>(
+        ebbrt::SharedIOBufRef::CloneView, std::move(rest)));
+    rest = std::move(next);
+  }
+  return ret;
+}
+
+// Take another reference on every buffer of a chain built by ShareChain
+template <typename T, typename... Args>
+std::unique_ptr<T> CloneChain(ebbrt::MutSharedIOBufRef &chain,
+                              Args &&... args) {
+  auto ret = ebbrt::IOBuf::Create<T>(std::forward<Args>(args)...,
+                                     ebbrt::SharedIOBufRef::CloneView, chain);
+  for (auto p = chain.Next(); p != &chain; p = p->Next()) {
+    ret->PrependChain(ebbrt::IOBuf::Create<ebbrt::MutSharedIOBufRef>(
+        ebbrt::SharedIOBufRef::CloneView,
+        *static_cast<ebbrt::MutSharedIOBufRef *>(p)));
+  }
+  return ret;
+}
+
+// Copy len bytes starting offset bytes into the chain
+void CopyChain(ebbrt::IOBuf &chain, size_t offset, uint8_t *dst, size_t len) {
+  for (auto &buf : chain) {
+    if (len == 0)
+      break;
+    auto buf_len = buf.Length();
+    if (offset >= buf_len) {
+      offset -= buf_len;
+      continue;
+    }
+    auto n = std::min(buf_len - offset, len);
+    std::memcpy(dst, buf.Data() + offset, n);
+    dst += n;
+    len -= n;
+    offset = 0;
+  }
+}
+
+// Capacity of the buffers bytes [offset, offset + len) of the chain lie in,
+// which stay allocated for as long as those bytes are referenced
+size_t Pinned(ebbrt::IOBuf &chain, size_t offset, size_t len) {
+  size_t pinned = 0;
+  for (auto &buf : chain) {
+    if (len == 0)
+      break;
+    auto buf_len = buf.Length();
+    if (offset >= buf_len) {
+      offset -= buf_len;
+      continue;
+    }
+    pinned += buf.Capacity();
+    len -= std::min(buf_len - offset, len);
+    offset = 0;
+  }
+  return pinned;
+}
+
+// A buffer of exactly len bytes, from the slab if it fits a class
+std::unique_ptr<ebbrt::MutIOBuf> TightBuffer(ebbrt::SlabAllocator &slab,
+                                             size_t len) {
+  if (len <= ebbrt::SlabAllocator::MaxSize()) {
+    return ebbrt::MutSlabIOBuf::Create(slab, len);
+  }
+  return ebbrt::MakeUniqueIOBuf(len);
+}
+
+// quiet commands only reply on failure, quiet gets not on a miss either
+bool IsQuiet(uint8_t opcode) {
+  switch (opcode) {
+  case PROTOCOL_BINARY_CMD_GETQ:
+  case PROTOCOL_BINARY_CMD_GETKQ:
+  case PROTOCOL_BINARY_CMD_SETQ:
+  case PROTOCOL_BINARY_CMD_ADDQ:
+  case PROTOCOL_BINARY_CMD_REPLACEQ:
+  case PROTOCOL_BINARY_CMD_DELETEQ:
+  case PROTOCOL_BINARY_CMD_INCREMENTQ:
+  case PROTOCOL_BINARY_CMD_DECREMENTQ:
+  case PROTOCOL_BINARY_CMD_QUITQ:
+  case PROTOCOL_BINARY_CMD_FLUSHQ:
+  case PROTOCOL_BINARY_CMD_APPENDQ:
+  case PROTOCOL_BINARY_CMD_PREPENDQ:
+    return true;
+  default:
+    return false;
+  }
+}
+
+uint64_t HostToNet64(uint64_t v) { return __builtin_bswap64(v); }
+
+uint64_t NetToHost64(uint64_t v) { return __builtin_bswap64(v); }
+
+// digits of UINT64_MAX
+const constexpr size_t kMaxDigits = 20;
+
+// Write v in decimal to buf, which has room for kMaxDigits and a NUL
+size_t FormatU64(uint64_t v, char *buf) {
+  return snprintf(buf, kMaxDigits + 1, "%llu", (unsigned long long)v);
+}
+
+// Text protocol tokens are separated by one or more spaces
+boost::string_ref NextToken(boost::string_ref &rest) {
+  size_t i = 0;
+  while (i < rest.size() && rest[i] == ' ') {
+    i++;
+  }
+  rest.remove_prefix(i);
+  i = 0;
+  while (i < rest.size() && rest[i] != ' ') {
+    i++;
+  }
+  auto token = rest.substr(0, i);
+  rest.remove_prefix(i);
+  return token;
+}
+
+bool ParseU64(boost::string_ref token, uint64_t *out) {
+  if (token.empty() || token.size() > 20) {
+    return false;
+  }
+  uint64_t val = 0;
+  for (auto c : token) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    uint64_t d = c - '0';
+    if (val > (UINT64_MAX - d) / 10) {
+      return false;
+    }
+    val = val * 10 + d;
+  }
+  *out = val;
+  return true;
+}
+
+bool ParseU32(boost::string_ref token, uint32_t *out) {
+  uint64_t val;
+  if (!ParseU64(token, &val) || val > UINT32_MAX) {
+    return false;
+  }
+  *out = val;
+  return true;
+}
+
+bool IsStorageCommand(boost::string_ref cmd) {
+  return cmd == "set" || cmd == "add" || cmd == "replace" || cmd == "cas" ||
+         cmd == "append" || cmd == "prepend";
+}
+
+// <cmd> <key> <flags> <exptime> <bytes> [noreply]: the length of the data
+// block that follows the line of a well formed storage command
+bool AsciiDataLength(boost::string_ref line, size_t *bytes) {
+  if (!IsStorageCommand(NextToken(line))) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    NextToken(line);
+  }
+  uint64_t len;
+  if (!ParseU64(NextToken(line), &len) || len > UINT32_MAX) {
+    return false;
+  }
+  *bytes = len;
+  return true;
+}
+
+std::unique_ptr<ebbrt::MutIOBuf> AsciiReply(boost::string_ref s) {
+  auto b = ebbrt::MakeUniqueIOBuf(s.size());
+  std::memcpy(b->MutData(), s.data(), s.size());
+  return std::move(b);
+}
+
+// A binary STAT response carrying one statistic, header optional
+std::unique_ptr<ebbrt::MutIOBuf> StatReply(uint32_t opaque,
+                                           boost::string_ref name,
+                                           boost::string_ref value,
+                                           bool header) {
+  auto hlen = header ? sizeof(protocol_binary_response_header) : 0;
+  auto b = ebbrt::MakeUniqueIOBuf(hlen + name.size() + value.size(), true);
+  auto dst = b->MutData();
+  if (header) {
+    auto r = reinterpret_cast<protocol_binary_response_header *>(dst);
+    r->response.magic = PROTOCOL_BINARY_RES;
+    r->response.opcode = PROTOCOL_BINARY_CMD_STAT;
+    r->response.keylen = htons(name.size());
+    r->response.bodylen = htonl(name.size() + value.size());
+    r->response.opaque = opaque;
+  }
+  std::memcpy(dst + hlen, name.data(), name.size());
+  std::memcpy(dst + hlen + name.size(), value.data(), value.size());
+  return std::move(b);
+}
+
+void AppendReply(std::unique_ptr<ebbrt::MutIOBuf> &chain,
+                 std::unique_ptr<ebbrt::MutIOBuf> b) {
+  if (chain) {
+    chain->PrependChain(std::move(b));
+  } else {
+    chain = std::move(b);
+  }
+}
+} // namespace
+
+std::unique_ptr<ebbrt::MutSharedIOBufRef>
+ebbrt::Memcached::VersionedResponse::Clone(uint64_t *version) {
+  auto ret = CloneChain<MutSharedIOBufRef>(*this);
+  if (likely(!counter)) {
+    *version = cas;
+    return ret;
+  }
+  // a sealed counter still reads as the value it was replaced at
+  auto n = number.load(std::memory_order_acquire) & ~kSealed;
+  auto digits = MakeUniqueIOBuf(kMaxDigits + 1);
+  auto len =
+      FormatU64(n & kMaxValue, reinterpret_cast<char *>(digits->MutData()));
+  digits->TrimEnd(kMaxDigits + 1 - len);
+  ret->PrependChain(IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
+                                                      std::move(digits)));
+  *version = Cas(n);
+  return ret;
+}
+
+size_t ebbrt::Memcached::VersionedResponse::Held() const {
+  size_t held = 0;
+  for (auto &buf : static_cast<const IOBuf &>(*this)) {
+    held += buf.Capacity();
+  }
+  return held;
+}
+
+uint64_t ebbrt::Memcached::VersionedResponse::Cas(uint64_t n) const {
+  if (!counter) {
+    return cas;
+  }
+  // distinct per version and update as long as versions fit the bits left
+  // over; plain versions stay below the top bit
+  auto sequence = (n & ~kSealed) >> kValueBits;
+  return kSealed | cas << (63 - kValueBits) | sequence;
+}
+
+std::unique_ptr<ebbrt::Memcached::VersionedResponse>
+ebbrt::Memcached::GetResponse::CreateBinaryResponse(Value v,
+                                                    boost::string_ref key,
+                                                    SlabAllocator &slab,
+                                                    uint64_t cas) {
+  // The stored response is <flags,key,value>
+  auto hlen = sizeof(v.flags) + key.size();
+  auto len = hlen + v.len;
+  if (len <= SlabAllocator::MaxSize() ||
+      Pinned(*v.buf, v.offset, v.len) > kCompactRatio * len) {
+    auto copy = TightBuffer(slab, len);
+    auto dst = copy->MutData();
+    std::memcpy(dst, &v.flags, sizeof(v.flags));
+    std::memcpy(dst + sizeof(v.flags), key.data(), key.size());
+    CopyChain(*v.buf, v.offset, dst + hlen, v.len);
+    return IOBuf::Create<VersionedResponse>(cas, SharedIOBufRef::CloneView,
+                                            std::move(copy));
+  }
+  // Either protocol puts at least hlen bytes of request ahead of the
+  // value. key may point into them, so save it before writing.
+  kassert(v.offset >= hlen);
+  char keybuf[KeyRef::kMaxLength];
+  std::memcpy(keybuf, key.data(), key.size());
+  auto trim = v.buf->ComputeChainDataLength() - v.offset - v.len;
+  auto ret = ShareChain<VersionedResponse>(std::move(v.buf), cas);
+  ret->AdvanceChain(v.offset - hlen);
+  if (trim > 0) {
+    ret->TrimEndChain(trim);
+  }
+  auto md = ret->GetMutDataPointer();
+  auto flags = reinterpret_cast<const uint8_t *>(&v.flags);
+  for (size_t i = 0; i < sizeof(v.flags); i++) {
+    md.Get<uint8_t>() = flags[i];
+  }
+  for (size_t i = 0; i < key.size(); i++) {
+    md.Get<uint8_t>() = keybuf[i];
+  }
+  return ret;
+}
+
+std::unique_ptr<ebbrt::Memcached::VersionedResponse>
+ebbrt::Memcached::GetResponse::Swap(std::unique_ptr<VersionedResponse> b) {
+  return std::unique_ptr<VersionedResponse>(
+      binary_response_.exchange(b.release(), std::memory_order_acq_rel));
+}
+
+bool ebbrt::Memcached::GetResponse::CompareExchange(
+    VersionedResponse *&expected, std::unique_ptr<VersionedResponse> &b) {
+  if (!binary_response_.compare_exchange_strong(expected, b.get(),
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+    return false;
+  }
+  b.release();
+  b.reset(expected);
+  return true;
+}
+
+size_t ebbrt::Memcached::GetResponse::Size() const {
+  auto resp = Current();
+  return resp ? resp->ComputeChainDataLength() : 0;
+}
+
+size_t ebbrt::Memcached::GetResponse::Held() const {
+  auto resp = Current();
+  return resp ? resp->Held() : 0;
+}
+
+ebbrt::Memcached::TableEntry *
+ebbrt::Memcached::TableEntry::Create(SlabAllocator &slab, Shard &shard,
+                                     boost::string_ref key,
+                                     std::unique_ptr<VersionedResponse> val,
+                                     size_t owner, uint32_t expires,
+                                     uint32_t generation) {
+  auto mem = static_cast<char *>(slab.Alloc(sizeof(TableEntry) + key.size()));
+  auto key_data = mem + sizeof(TableEntry);
+  std::memcpy(key_data, key.data(), key.size());
+  return new (mem) TableEntry(boost::string_ref(key_data, key.size()),
+                              std::move(val), shard, owner, expires,
+                              generation);
+}
+
+void ebbrt::Memcached::TableEntry::Destroy(TableEntry *entry) {
+  entry->~TableEntry();
+  SlabAllocator::Free(entry);
+}
+
+uint32_t ebbrt::Memcached::CurrentTime() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             clock::Wall::Now().time_since_epoch())
+      .count();
+}
+
+uint32_t ebbrt::Memcached::ExpiryTime(uint32_t exptime, uint32_t now) {
+  if (exptime == 0 || exptime > kRelativeExpiryMax) {
+    return exptime;
+  }
+  return now + exptime;
+}
+
+/**
+ * ShardFor() - tables index buckets by the low hash bits, so pick the shard
+ * from the high bits of a multiplicative mix to keep the two independent
+ */
+ebbrt::Memcached::Shard &ebbrt::Memcached::ShardFor(size_t hash) {
+  uint64_t mix = hash * 0x9e3779b97f4a7c15ull;
+  return *shards_[(mix >> 32) & shard_mask_];
+}
+
+/**
+ * ReadKey() - reference the key in place when it sits in one buffer of the
+ * chain, otherwise gather it into scratch (at least KeyRef::kMaxLength
+ * bytes). len must not exceed KeyRef::kMaxLength.
+ */
+ebbrt::KeyRef ebbrt::Memcached::ReadKey(IOBuf &chain, size_t offset,
+                                        size_t len, char *scratch) {
+  for (auto &buf : chain) {
+    auto buf_len = buf.Length();
+    if (offset >= buf_len) {
+      offset -= buf_len;
+      continue;
+    }
+    if (offset + len <= buf_len) {
+      return KeyRef(boost::string_ref(
+          reinterpret_cast<const char *>(buf.Data()) + offset, len));
+    }
+    CopyChain(buf, offset, reinterpret_cast<uint8_t *>(scratch), len);
+    break;
+  }
+  return KeyRef(boost::string_ref(scratch, len));
+}
+
+/**
+ * Live() - false once an entry has passed its expiry or been flushed. Dead
+ * entries read as misses until the owner's reaper unlinks them.
+ */
+bool ebbrt::Memcached::Live(const TableEntry &entry, uint32_t now) const {
+  auto expires = entry.expires.load(std::memory_order_relaxed);
+  if (unlikely(expires != 0 && expires <= now)) {
+    return false;
+  }
+  // load flush_ first: Flush() publishes flushed_below_ ahead of it
+  auto flush = flush_.load(std::memory_order_acquire);
+  if (unlikely(entry.generation <= uint32_t(flush) &&
+               now >= uint32_t(flush >> 32))) {
+    return false;
+  }
+  return likely(entry.generation >=
+                flushed_below_.load(std::memory_order_relaxed));
+}
+
+/**
+ * Generation() - the flush generation to store new entries in: that of
+ * the latest flush while it is pending, so they go with it, and the next
+ * one once it is in force
+ */
+uint32_t ebbrt::Memcached::Generation(uint32_t now) const {
+  auto flush = flush_.load(std::memory_order_acquire);
+  auto gen = uint32_t(flush);
+  return now >= uint32_t(flush >> 32) ? gen + 1 : gen;
+}
+
+ebbrt::Memcached::VersionedResponse *
+ebbrt::Memcached::Get(const KeyRef &key) {
+  auto &core = *cores_[size_t(Cpu::GetMine())];
+  auto p = ShardFor(key.hash).table.find(key.key, key.hash);
+  VersionedResponse *res = nullptr;
+  if (p && Live(*p, core.now)) {
+    // nullptr if the entry is being unlinked
+    res = p->value.Current();
+  }
+  if (!res) {
+    // cache miss
+    core.stats.misses++;
+    return nullptr;
+  } else {
+    // cache hit
+    core.stats.hits++;
+    // only write the CLOCK bit when it changes to keep hot lines shared
+    if (!p->referenced.load(std::memory_order_relaxed)) {
+      p->referenced.store(true, std::memory_order_relaxed);
+    }
+    // a counter's value lives in the version, it is never copied
+    if (replicate_ && likely(!res->counter)) {
+      res = Replicated(core, *p, res, key.hash);
+    }
+    return res;
+  }
+}
+
+/**
+ * Replicated() - the version a GET hit on this core is served from: the
+ * core's replica if the key is hot here, refreshed first if the entry has
+ * moved past the version copied. Every kHotSample-th hit is counted in the
+ * core's sketch, and a key estimated at kHotThreshold takes over the slot
+ * its hash maps to.
+ */
+ebbrt::Memcached::VersionedResponse *
+ebbrt::Memcached::Replicated(CoreStore &core, TableEntry &entry,
+                             VersionedResponse *res, size_t hash) {
+  auto &slot = core.replicas[hash & (kReplicas - 1)];
+  auto hot = slot.entry == &entry;
+  if (hot && slot.cas == res->cas) {
+    slot.hits++;
+    core.stats.replica_hits++;
+    return slot.copy.get();
+  }
+  if (--core.hot_countdown == 0) {
+    core.hot_countdown = kHotSample;
+    hot = core.sketch.Add(hash) >= kHotThreshold || hot;
+  }
+  if (!hot) {
+    return res;
+  }
+  auto len = res->ComputeChainDataLength();
+  if (len > kMaxReplica) {
+    return res;
+  }
+  auto copy = TightBuffer(slab_, len);
+  CopyChain(*res, 0, copy->MutData(), len);
+  if (slot.entry != &entry) {
+    slot.entry = &entry;
+    slot.key_len = entry.key.size();
+    slot.hits = slot.tick_hits = 0;
+  }
+  if (slot.copy) {
+    // a GET earlier in this event may still be cloning the old copy
+    event_manager->DoRcu([old = std::move(slot.copy)]() mutable {});
+  }
+  slot.cas = res->cas;
+  slot.copy = IOBuf::Create<VersionedResponse>(
+      res->cas, SharedIOBufRef::CloneView, std::move(copy));
+  core.stats.replica_copies++;
+  return slot.copy.get();
+}
+
+/**
+ * UpdateHotKeys() - on the reaper tick: age the sketch, drop the replicas
+ * no GET used since the last tick and publish the rest for STAT
+ */
+void ebbrt::Memcached::UpdateHotKeys(CoreStore &core) {
+  core.sketch.Decay();
+  std::vector<std::pair<std::string, uint64_t>> hot;
+  for (auto &slot : core.replicas) {
+    if (!slot.copy) {
+      continue;
+    }
+    auto hits = slot.hits - slot.tick_hits;
+    if (hits == 0) {
+      event_manager->DoRcu([old = std::move(slot.copy)]() mutable {});
+      slot.entry = nullptr;
+      continue;
+    }
+    slot.tick_hits = slot.hits;
+    // stored as <flags,key,value> in one buffer
+    auto key =
+        reinterpret_cast<const char *>(slot.copy->Data()) + sizeof(uint32_t);
+    hot.emplace_back(std::string(key, slot.key_len), hits);
+  }
+  std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+  core.hot.swap(hot);
+}
+
+/**
+ * NextCas() - versions are unique across cores without sharing a counter
+ */
+uint64_t ebbrt::Memcached::NextCas() {
+  auto mycpu = size_t(Cpu::GetMine());
+  return ++cores_[mycpu]->cas_seq * cores_.size() + mycpu;
+}
+
+/**
+ * Set() - store v under key. ADD only stores a key that is absent or
+ * expired, REPLACE only one that is live. If cas is given and non-zero the
+ * item must still be at that version; on success it is set to the version
+ * written.
+ */
+ebbrt::Memcached::Result ebbrt::Memcached::Set(Value v, const KeyRef &key,
+                                               uint32_t exptime,
+                                               StoreMode mode, uint64_t *cas) {
+  auto mycpu = size_t(Cpu::GetMine());
+  auto &stats = cores_[mycpu]->stats;
+  auto now = cores_[mycpu]->now;
+  auto expires = ExpiryTime(exptime, now);
+  auto expected = cas ? *cas : 0;
+  auto len = v.len;
+  auto &shard = ShardFor(key.hash);
+  auto keylen = key.key.size();
+  // key may point into v.buf, once v is consumed this refers to keybuf
+  auto stored_key = key.key;
+  char keybuf[KeyRef::kMaxLength];
+  std::unique_ptr<VersionedResponse> val;
+  auto p = shard.table.find(key.key, key.hash);
+  while (true) {
+    auto live = p && Live(*p, now) && p->value.Current() != nullptr;
+    if ((mode == StoreMode::kAdd && live) ||
+        (mode == StoreMode::kReplace && !live)) {
+      return Result::kNotStored;
+    }
+    if (expected != 0 && !live) {
+      return Result::kNotFound;
+    }
+    if (!val) {
+      auto version = NextCas();
+      if (cas) {
+        *cas = version;
+      }
+      val = GetResponse::CreateBinaryResponse(std::move(v), stored_key, slab_,
+                                              version);
+      CopyChain(*val, sizeof(uint32_t), reinterpret_cast<uint8_t *>(keybuf),
+                keylen);
+      stored_key = boost::string_ref(keybuf, keylen);
+    }
+    if (live) {
+      auto res = Replace(*p, val, expected, expires);
+      if (res == Result::kOk) {
+        stats.sets++;
+        stats.set_bytes += len;
+      }
+      if (res != Result::kNotFound) {
+        Reclaim();
+        return res;
+      }
+      if (expected != 0) {
+        return res;
+      }
+      // unlinked under us, store it as a new entry
+    }
+    {
+      // Double check that there is no matching key while holding the lock
+      std::lock_guard<ebbrt::SpinLock> guard(shard.lock);
+      p = shard.table.find(stored_key, key.hash);
+      if (p && !Live(*p, now)) {
+        // take out the expired entry rather than writing into it, or the
+        // reaper could unlink the new value with it
+        auto &owner = *cores_[p->owner];
+        std::lock_guard<ebbrt::SpinLock> core_guard(owner.lock);
+        if (p->clock_hook.is_linked()) {
+          Unlink(*p, shard, owner);
+        }
+        p = nullptr;
+      }
+      if (!p) {
+        auto entry =
+            TableEntry::Create(slab_, shard, stored_key, std::move(val),
+                               mycpu, expires, Generation(now));
+        shard.table.insert(*entry, key.hash);
+        Track(*entry);
+        MaybeResize(shard);
+      }
+    }
+    if (!p) {
+      stats.sets++;
+      stats.set_bytes += len;
+      Reclaim();
+      return Result::kOk;
+    }
+    // found a live entry on the double check
+  }
+}
+
+/**
+ * Replace() - install val on a live entry if it is still at version
+ * expected, or unconditionally if expected is zero. A null val takes the
+ * value out. Fails with kNotFound once the entry is being unlinked, which
+ * takes its value out first. On success val holds the replaced version,
+ * which has been released.
+ */
+ebbrt::Memcached::Result
+ebbrt::Memcached::Replace(TableEntry &entry,
+                          std::unique_ptr<VersionedResponse> &val,
+                          uint64_t expected, uint32_t expires) {
+  auto new_len = val ? val->ComputeChainDataLength() : 0;
+  auto new_held = val ? val->Held() : 0;
+  auto cur = entry.value.Current();
+  while (true) {
+    if (cur == nullptr) {
+      return Result::kNotFound;
+    }
+    if (cur->counter) {
+      // Seal the counter at the value checked so no increment can land on
+      // it once it is replaced. Only Retire() swaps a sealed version out
+      // from under us, and that leaves nullptr behind.
+      auto n = cur->number.load(std::memory_order_acquire);
+      if (n & VersionedResponse::kSealed) {
+        // another write is taking its place
+        cur = entry.value.Current();
+        continue;
+      }
+      if (expected != 0 && cur->Cas(n) != expected) {
+        return Result::kExists;
+      }
+      if (!cur->number.compare_exchange_weak(n, n | VersionedResponse::kSealed,
+                                             std::memory_order_acq_rel)) {
+        continue;
+      }
+    } else if (expected != 0 && cur->cas != expected) {
+      return Result::kExists;
+    }
+    if (entry.value.CompareExchange(cur, val)) {
+      break;
+    }
+  }
+  if (entry.expires.exchange(expires, std::memory_order_relaxed) != expires) {
+    Schedule(entry, expires);
+  }
+  // Charge the difference to the owner; the value freed with the entry is
+  // whatever was swapped in last, so the accounting stays exact.
+  Charge(entry.owner, new_len, new_held);
+  Release(entry.owner, std::move(val));
+  return Result::kOk;
+}
+
+/**
+ * Release() - free a version taken off an entry and uncharge it from the
+ * owner. We must wait an RCU generation here because a concurrent GET may
+ * be constructing it's response.
+ */
+void ebbrt::Memcached::Release(size_t owner,
+                               std::unique_ptr<VersionedResponse> val) {
+  if (!val) {
+    return;
+  }
+  Uncharge(owner, val->ComputeChainDataLength(), val->Held());
+  event_manager->DoRcu([old = std::move(val)]() mutable {});
+}
+
+/**
+ * Concat() - APPEND or PREPEND v to a live item. Results that fit a slab
+ * class are copied into one buffer like any small value. Larger ones link
+ * references to the current version's buffers and the new bytes into a new
+ * chain, so nothing already stored is copied.
+ */
+ebbrt::Memcached::Result ebbrt::Memcached::Concat(Value v, const KeyRef &key,
+                                                  bool append, uint64_t *cas) {
+  auto now = cores_[size_t(Cpu::GetMine())]->now;
+  auto expected = cas ? *cas : 0;
+  auto p = ShardFor(key.hash).table.find(key.key, key.hash);
+  if (!p || !Live(*p, now)) {
+    return Result::kNotStored;
+  }
+  // share the new bytes once, every attempt below takes references to them
+  std::unique_ptr<MutSharedIOBufRef> data;
+  if (Pinned(*v.buf, v.offset, v.len) > kCompactRatio * v.len) {
+    // copied out rather than pin request buffers many times their size
+    auto copy = TightBuffer(slab_, v.len);
+    CopyChain(*v.buf, v.offset, copy->MutData(), v.len);
+    data = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
+                                            std::move(copy));
+  } else {
+    auto trim = v.buf->ComputeChainDataLength() - v.offset - v.len;
+    data = ShareChain<MutSharedIOBufRef>(std::move(v.buf));
+    data->AdvanceChain(v.offset);
+    if (trim > 0) {
+      data->TrimEndChain(trim);
+    }
+  }
+  auto hlen = sizeof(uint32_t) + p->key.size();
+  while (true) {
+    auto cur = p->value.Current();
+    if (cur == nullptr) {
+      return Result::kNotStored;
+    }
+    // work from a snapshot, a counter may change under us
+    uint64_t cur_cas;
+    auto snap = cur->Clone(&cur_cas);
+    if (expected != 0 && cur_cas != expected) {
+      return Result::kExists;
+    }
+    auto cur_len = snap->ComputeChainDataLength();
+    auto len = cur_len + v.len;
+    auto version = NextCas();
+    std::unique_ptr<VersionedResponse> next;
+    if (len <= SlabAllocator::MaxSize()) {
+      auto copy = MutSlabIOBuf::Create(slab_, len);
+      auto dst = copy->MutData();
+      if (append) {
+        CopyChain(*snap, 0, dst, cur_len);
+        CopyChain(*data, 0, dst + cur_len, v.len);
+      } else {
+        CopyChain(*snap, 0, dst, hlen);
+        CopyChain(*data, 0, dst + hlen, v.len);
+        CopyChain(*snap, hlen, dst + hlen + v.len, cur_len - hlen);
+      }
+      next = IOBuf::Create<VersionedResponse>(
+          version, SharedIOBufRef::CloneView, std::move(copy));
+    } else if (append) {
+      next = CloneChain<VersionedResponse>(*snap, version);
+      next->PrependChain(CloneChain<MutSharedIOBufRef>(*data));
+    } else {
+      // <flags,key> go in front of the new bytes
+      auto head = MutSlabIOBuf::Create(slab_, hlen);
+      CopyChain(*snap, 0, head->MutData(), hlen);
+      next = IOBuf::Create<VersionedResponse>(
+          version, SharedIOBufRef::CloneView, std::move(head));
+      next->PrependChain(CloneChain<MutSharedIOBufRef>(*data));
+      auto old = std::move(snap);
+      old->AdvanceChain(hlen);
+      next->PrependChain(std::move(old));
+    }
+    auto res = Replace(*p, next, cur_cas,
+                       p->expires.load(std::memory_order_relaxed));
+    if (res == Result::kOk) {
+      if (cas) {
+        *cas = version;
+      }
+      Reclaim();
+      return res;
+    }
+    if (res == Result::kNotFound) {
+      return Result::kNotStored;
+    }
+    // lost a race with another write, redo it on top of that one
+  }
+}
+
+/**
+ * Delete() - unlink a live entry, it is freed once readers are done. With a
+ * non-zero cas the entry is only removed at that version.
+ */
+ebbrt::Memcached::Result ebbrt::Memcached::Delete(const KeyRef &key,
+                                                  uint64_t cas) {
+  auto now = cores_[size_t(Cpu::GetMine())]->now;
+  auto &shard = ShardFor(key.hash);
+  std::lock_guard<ebbrt::SpinLock> shard_guard(shard.lock);
+  auto p = shard.table.find(key.key, key.hash);
+  if (!p || !Live(*p, now)) {
+    return Result::kNotFound;
+  }
+  auto cur = p->value.Current();
+  if (cur == nullptr) {
+    return Result::kNotFound;
+  }
+  if (cas != 0) {
+    // take the value out at the version checked, a concurrent write then
+    // fails and stores a new entry once this one is unlinked
+    std::unique_ptr<VersionedResponse> none;
+    auto res =
+        Replace(*p, none, cas, p->expires.load(std::memory_order_relaxed));
+    if (res != Result::kOk) {
+      return res;
+    }
+  }
+  auto &owner = *cores_[p->owner];
+  std::lock_guard<ebbrt::SpinLock> core_guard(owner.lock);
+  Unlink(*p, shard, owner);
+  return Result::kOk;
 }
 
-std::unique_ptr<ebbrt::IOBuf> ebbrt::Memcached::GetResponse::Binary() {
-    // We must atomically read the pointer once to ensure it is consistent
-  auto resp = binary_response_.get();
-  kassert(resp != nullptr);
-  auto brptr = resp;
-  auto remainder = resp->Next();
-  auto ret = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
-                                              *resp);
-  while (remainder != brptr) {
-    auto next = remainder->Next();
-    auto ref = IOBuf::Create<IOBufRef>(IOBufRef::CloneView, *remainder);
-    ret->PrependChain(std::move(ref));
-    remainder = next;
+/**
+ * Arith() - add delta to, or subtract it from, a decimal value. Increments
+ * wrap at 64 bits and decrements stop at zero.
+ *
+ * The first update turns the item into a counter holding its value
+ * natively, later ones compare-exchange that value and its update sequence
+ * in place without parsing or building anything. Values from 2^48 up do not
+ * fit a counter and stay decimal, and a counter that runs out of sequence
+ * numbers takes a new version. Whenever a new version is installed it only goes in if
+ * the one it was computed from is still current, so concurrent updates are
+ * never lost.
+ */
+ebbrt::Memcached::Result ebbrt::Memcached::Arith(const KeyRef &key, bool incr,
+                                                 uint64_t delta,
+                                                 uint64_t *result,
+                                                 uint64_t *cas) {
+  auto apply = [incr, delta](uint64_t val) {
+    if (incr) {
+      return val + delta;
+    }
+    return delta > val ? 0 : val - delta;
+  };
+  auto now = cores_[size_t(Cpu::GetMine())]->now;
+  auto p = ShardFor(key.hash).table.find(key.key, key.hash);
+  if (!p || !Live(*p, now)) {
+    return Result::kNotFound;
+  }
+  auto hlen = sizeof(uint32_t) + p->key.size();
+  while (true) {
+    auto cur = p->value.Current();
+    if (cur == nullptr) {
+      return Result::kNotFound;
+    }
+    uint64_t val;
+    uint64_t expected;
+    if (likely(cur->counter)) {
+      auto n = cur->number.load(std::memory_order_acquire);
+      if (n & VersionedResponse::kSealed) {
+        // being replaced, pick up the version that follows
+        continue;
+      }
+      auto sequence = n >> VersionedResponse::kValueBits;
+      val = apply(n & VersionedResponse::kMaxValue);
+      if (likely(val <= VersionedResponse::kMaxValue &&
+                 sequence < VersionedResponse::kMaxSequence)) {
+        auto next = val | (sequence + 1) << VersionedResponse::kValueBits;
+        if (!cur->number.compare_exchange_weak(n, next,
+                                               std::memory_order_acq_rel)) {
+          continue;
+        }
+        *result = val;
+        if (cas) {
+          *cas = cur->Cas(next);
+        }
+        return Result::kOk;
+      }
+      // out of value bits or sequence numbers, take a new version
+      expected = cur->Cas(n);
+    } else {
+      auto len = cur->ComputeChainDataLength() - hlen;
+      if (len == 0 || len > kMaxDigits) {
+        return Result::kNonNumeric;
+      }
+      char digits[kMaxDigits];
+      CopyChain(*cur, hlen, reinterpret_cast<uint8_t *>(digits), len);
+      if (!ParseU64(boost::string_ref(digits, len), &val)) {
+        return Result::kNonNumeric;
+      }
+      val = apply(val);
+      expected = cur->cas;
+    }
+    auto version = NextCas();
+    std::unique_ptr<VersionedResponse> next;
+    if (val <= VersionedResponse::kMaxValue) {
+      // <flags,key> carry over, the value lives in number
+      auto head = MutSlabIOBuf::Create(slab_, hlen);
+      CopyChain(*cur, 0, head->MutData(), hlen);
+      next = IOBuf::Create<VersionedResponse>(
+          version, SharedIOBufRef::CloneView, std::move(head));
+      next->counter = true;
+      next->number.store(val, std::memory_order_relaxed);
+    } else {
+      char digits[kMaxDigits + 1];
+      auto n = FormatU64(val, digits);
+      uint32_t flags;
+      CopyChain(*cur, 0, reinterpret_cast<uint8_t *>(&flags), sizeof(flags));
+      Value v{IOBuf::Create<StaticIOBuf>(
+                  reinterpret_cast<const uint8_t *>(digits), n),
+              0, n, flags};
+      next = GetResponse::CreateBinaryResponse(std::move(v), p->key, slab_,
+                                               version);
+    }
+    auto next_cas = next->Cas(next->number.load(std::memory_order_relaxed));
+    auto res = Replace(*p, next, expected,
+                       p->expires.load(std::memory_order_relaxed));
+    if (res == Result::kOk) {
+      *result = val;
+      if (cas) {
+        *cas = next_cas;
+      }
+      return res;
+    }
+    if (res == Result::kNotFound) {
+      return res;
+    }
+    // lost a race with another write, start over from its value
+  }
+}
+
+/**
+ * Track() - place a freshly inserted entry on its owner's CLOCK list and
+ * timer wheel and charge its footprint. Caller must hold the entry's shard
+ * lock.
+ */
+void ebbrt::Memcached::Track(TableEntry &entry) {
+  auto &core = *cores_[entry.owner];
+  std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+  core.clock.push_back(entry);
+  auto expires = entry.expires.load(std::memory_order_relaxed);
+  if (expires != 0) {
+    entry.wheel_deadline = expires;
+    core.wheel.Insert(entry);
+  }
+  core.items++;
+  Charge(entry.owner, entry.Footprint(), entry.Held());
+}
+
+/**
+ * Schedule() - an overwrite changed the expiry. Only an earlier deadline
+ * needs the wheel touched; later or cleared deadlines are fixed up by the
+ * reaper when the old slot comes due.
+ */
+void ebbrt::Memcached::Schedule(TableEntry &entry, uint32_t expires) {
+  if (expires == 0) {
+    return;
+  }
+  auto &core = *cores_[entry.owner];
+  std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+  // an entry off its CLOCK list has been unlinked and must not be requeued
+  if (!entry.clock_hook.is_linked()) {
+    return;
+  }
+  if (entry.wheel_hook.is_linked() && entry.wheel_deadline <= expires) {
+    return;
+  }
+  entry.wheel_hook.unlink();
+  entry.wheel_deadline = expires;
+  core.wheel.Insert(entry);
+}
+
+/**
+ * Charge() - account bytes stored for owner, on its core and against the
+ * memory limit
+ */
+void ebbrt::Memcached::Charge(size_t owner, size_t bytes, size_t held) {
+  cores_[owner]->resident_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  cores_[owner]->held_bytes.fetch_add(held, std::memory_order_relaxed);
+  resident_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ebbrt::Memcached::Uncharge(size_t owner, size_t bytes, size_t held) {
+  cores_[owner]->resident_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  cores_[owner]->held_bytes.fetch_sub(held, std::memory_order_relaxed);
+  resident_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+/**
+ * Reclaim() - evict from this core's CLOCK list until the store is back
+ * under the memory limit. Referenced entries get a second chance. A core
+ * with nothing left to evict hands the rest to another, see Nudge().
+ *
+ * Victims are picked under the core lock alone and then relocked in shard,
+ * core order. An entry removed in between is off its CLOCK list by then and
+ * still allocated, since it is only freed after this event ends.
+ */
+void ebbrt::Memcached::Reclaim() {
+  auto mycpu = size_t(Cpu::GetMine());
+  auto &core = *cores_[mycpu];
+  core.nudged.store(false, std::memory_order_relaxed);
+  // resident_bytes_ only drops once the RCU callbacks run, so track what
+  // this pass has already released
+  auto resident = resident_bytes_.load(std::memory_order_relaxed);
+  size_t chances = 0;
+  while (unlikely(resident > memory_limit_)) {
+    TableEntry *victim = nullptr;
+    {
+      std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+      while (!core.clock.empty()) {
+        auto &entry = core.clock.front();
+        // advance the hand past the entry whatever happens to it
+        core.clock.pop_front();
+        core.clock.push_back(entry);
+        if (entry.referenced.load(std::memory_order_relaxed) &&
+            chances < kClockScanMax) {
+          entry.referenced.store(false, std::memory_order_relaxed);
+          chances++;
+          continue;
+        }
+        victim = &entry;
+        break;
+      }
+    }
+    if (victim == nullptr) {
+      Nudge(mycpu);
+      return;
+    }
+    auto &shard = *victim->shard;
+    std::lock_guard<ebbrt::SpinLock> shard_guard(shard.lock);
+    std::lock_guard<ebbrt::SpinLock> core_guard(core.lock);
+    if (!victim->clock_hook.is_linked()) {
+      continue;
+    }
+    core.stats.evictions++;
+    auto footprint = victim->Footprint();
+    resident = resident > footprint ? resident - footprint : 0;
+    Unlink(*victim, shard, core);
+  }
+}
+
+/**
+ * Nudge() - this core is over the memory limit with an empty CLOCK list,
+ * as when writes here replace entries other cores own. Have the core
+ * charged the most bytes run Reclaim(), unless it has a nudge pending.
+ */
+void ebbrt::Memcached::Nudge(size_t mycpu) {
+  auto owner = mycpu;
+  size_t most = 0;
+  for (size_t i = 0; i < cores_.size(); i++) {
+    auto resident = cores_[i]->resident_bytes.load(std::memory_order_relaxed);
+    if (i != mycpu && resident > most) {
+      owner = i;
+      most = resident;
+    }
+  }
+  if (owner == mycpu ||
+      cores_[owner]->nudged.exchange(true, std::memory_order_relaxed)) {
+    return;
+  }
+  event_manager->SpawnRemote([this]() { Reclaim(); }, owner);
+}
+
+/**
+ * Expire() - once a second tick on every core: advance the local wheel,
+ * start reaping whatever came due and evict if the store is over the
+ * memory limit, which writes on other cores can leave it.
+ */
+void ebbrt::Memcached::Expire() {
+  auto &core = *cores_[size_t(Cpu::GetMine())];
+  auto now = CurrentTime();
+  // the lowest generation still live, it rises as flushes come into force
+  auto flush = flush_.load(std::memory_order_acquire);
+  auto floor = now >= uint32_t(flush >> 32)
+                   ? uint32_t(flush) + 1
+                   : flushed_below_.load(std::memory_order_relaxed);
+  UpdateLoad(core);
+  UpdateHotKeys(core);
+  size_t sweep = 0;
+  bool reap;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+    core.now = now;
+    core.wheel.Advance(now, core.due);
+    reap = !core.due.empty();
+    if (core.swept < floor) {
+      core.swept = floor;
+      sweep = core.items;
+    }
+  }
+  if (sweep > 0) {
+    Sweep(sweep);
+  }
+  if (reap) {
+    Reap();
+  }
+  Reclaim();
+}
+
+/**
+ * UpdateLoad() - fold the share of the last tick this core spent in
+ * Receive() into its utilization. With rebalancing on, a core well above
+ * the average sheds one connection before the next tick.
+ */
+void ebbrt::Memcached::UpdateLoad(CoreStore &core) {
+  auto &load = core.load;
+  auto now = clock::Wall::Now();
+  uint64_t elapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now - load.tick_time)
+          .count();
+  if (elapsed == 0) {
+    return;
+  }
+  auto busy = load.busy_ns - load.tick_busy_ns;
+  auto sample = uint32_t(std::min<uint64_t>(busy * 1000 / elapsed, 1000));
+  auto util = (load.utilization.load(std::memory_order_relaxed) + sample) / 2;
+  load.utilization.store(util, std::memory_order_relaxed);
+  load.window_requests = load.requests - load.tick_requests;
+  load.request_rate = load.window_requests * 1000000000 / elapsed;
+  load.tick_busy_ns = load.busy_ns;
+  load.tick_requests = load.requests;
+  load.tick_time = now;
+  load.ticks++;
+  load.shed = 0;
+  if (!rebalance_ || load.sessions.load(std::memory_order_relaxed) < 2) {
+    return;
+  }
+  uint64_t total = 0;
+  for (auto &c : cores_) {
+    total += c->load.utilization.load(std::memory_order_relaxed);
+  }
+  if (util > total / cores_.size() + kImbalance) {
+    load.shed = 1;
+  }
+}
+
+/**
+ * LeastLoaded() - the core with the lowest utilization, compared in steps
+ * of kLoadStep so that near ties go to the one with fewer connections
+ */
+size_t ebbrt::Memcached::LeastLoaded() const {
+  size_t best = 0;
+  uint64_t best_key = UINT64_MAX;
+  for (size_t i = 0; i < cores_.size(); i++) {
+    auto &load = cores_[i]->load;
+    uint64_t key =
+        uint64_t(load.utilization.load(std::memory_order_relaxed) / kLoadStep)
+            << 32 |
+        load.sessions.load(std::memory_order_relaxed);
+    if (key < best_key) {
+      best = i;
+      best_key = key;
+    }
+  }
+  return best;
+}
+
+/**
+ * Reap() - unlink at most kReapBatch due entries, then requeue itself
+ * behind pending events so a large expiry wave never stalls Receive.
+ * Entries are relocked in shard, core order as in Reclaim().
+ */
+void ebbrt::Memcached::Reap() {
+  auto &core = *cores_[size_t(Cpu::GetMine())];
+  for (size_t i = 0; i < kReapBatch; i++) {
+    TableEntry *entry;
+    {
+      std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+      if (core.due.empty()) {
+        return;
+      }
+      entry = &core.due.front();
+      core.due.pop_front();
+    }
+    auto &shard = *entry->shard;
+    std::lock_guard<ebbrt::SpinLock> shard_guard(shard.lock);
+    std::lock_guard<ebbrt::SpinLock> core_guard(core.lock);
+    if (!entry->clock_hook.is_linked()) {
+      // already unlinked
+      continue;
+    }
+    auto expires = entry->expires.load(std::memory_order_relaxed);
+    if (expires == 0) {
+      // made permanent by a later SET
+      continue;
+    }
+    if (expires > core.now) {
+      // extended by a later SET, which may have requeued it already
+      if (!entry->wheel_hook.is_linked()) {
+        entry->wheel_deadline = expires;
+        core.wheel.Insert(*entry);
+      }
+      continue;
+    }
+    Unlink(*entry, shard, core);
+  }
+  event_manager->SpawnLocal([this]() { Reap(); }, /* force_async = */ true);
+}
+
+/**
+ * Sweep() - after a flush comes into force, walk this core's CLOCK list
+ * and unlink dead entries, at most remaining of them in all and at most
+ * kReapBatch per event, so the old contents are freed without stalling
+ * Receive.
+ * Entries are relocked in shard, core order as in Reclaim().
+ */
+void ebbrt::Memcached::Sweep(size_t remaining) {
+  auto &core = *cores_[size_t(Cpu::GetMine())];
+  for (size_t i = 0; i < kReapBatch && remaining > 0; i++, remaining--) {
+    TableEntry *entry;
+    {
+      std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+      if (core.clock.empty()) {
+        return;
+      }
+      // move the hand on as Reclaim() does
+      entry = &core.clock.front();
+      core.clock.pop_front();
+      core.clock.push_back(*entry);
+      if (Live(*entry, core.now)) {
+        continue;
+      }
+    }
+    auto &shard = *entry->shard;
+    std::lock_guard<ebbrt::SpinLock> shard_guard(shard.lock);
+    std::lock_guard<ebbrt::SpinLock> core_guard(core.lock);
+    if (entry->clock_hook.is_linked()) {
+      Unlink(*entry, shard, core);
+    }
+  }
+  if (remaining > 0) {
+    event_manager->SpawnLocal([this, remaining]() { Sweep(remaining); },
+                              /* force_async = */ true);
+  }
+}
+
+/**
+ * Unlink() - remove an entry from its shard's table and its owner's lists
+ * and retire it. Caller must hold the shard lock and the owner's lock.
+ */
+void ebbrt::Memcached::Unlink(TableEntry &entry, Shard &shard,
+                              CoreStore &owner) {
+  shard.table.erase(entry);
+  owner.clock.erase(owner.clock.iterator_to(entry));
+  entry.wheel_hook.unlink();
+  owner.items--;
+  Retire(entry);
+  MaybeResize(shard);
+}
+
+/**
+ * MaybeResize() - kick off a background resize if the shard's load factor
+ * has left its band. Caller must hold the shard lock.
+ */
+void ebbrt::Memcached::MaybeResize(Shard &shard) {
+  if (likely(shard.table.DesiredBits() == 0) ||
+      shard.resize_scheduled.exchange(true, std::memory_order_relaxed)) {
+    return;
+  }
+  event_manager->SpawnLocal([this, &shard]() { Resize(shard); },
+                            /* force_async = */ true);
+}
+
+/**
+ * Resize() - allocate the new bucket array outside of the shard lock,
+ * publish it, then migrate in batches. Writes in the meantime migrate a few
+ * buckets each as well.
+ */
+void ebbrt::Memcached::Resize(Shard &shard) {
+  size_t bits;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(shard.lock);
+    bits = shard.table.DesiredBits();
+  }
+  if (bits == 0) {
+    shard.resize_scheduled.store(false, std::memory_order_relaxed);
+    return;
+  }
+  auto buckets = shard.table.AllocateBuckets(bits);
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(shard.lock);
+    if (shard.table.DesiredBits() != bits ||
+        !shard.table.BeginResize(std::move(buckets))) {
+      shard.resize_scheduled.store(false, std::memory_order_relaxed);
+      return;
+    }
+  }
+  MigrateBuckets(shard);
+}
+
+void ebbrt::Memcached::MigrateBuckets(Shard &shard) {
+  bool more;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(shard.lock);
+    more = shard.table.Migrate(kMigrateBatch);
+  }
+  if (more) {
+    event_manager->SpawnLocal([this, &shard]() { MigrateBuckets(shard); },
+                              /* force_async = */ true);
+  } else {
+    shard.resize_scheduled.store(false, std::memory_order_relaxed);
+  }
+}
+
+void ebbrt::Memcached::WriteSnapshot(
+    std::function<void(std::unique_ptr<IOBuf>)> sink,
+    std::function<void(size_t items)> done) {
+  auto header = MakeUniqueIOBuf(sizeof(SnapshotHeader), true);
+  auto h = reinterpret_cast<SnapshotHeader *>(header->MutData());
+  h->magic = kSnapshotMagic;
+  h->version = kSnapshotVersion;
+  sink(std::move(header));
+  auto walk = std::unique_ptr<SnapshotWalk>(new SnapshotWalk());
+  walk->sink = std::move(sink);
+  walk->done = std::move(done);
+  SnapshotBatch(std::move(walk));
+}
+
+/**
+ * SnapshotBatch() - write the records of the next kSnapshotBatch buckets.
+ * Each is taken from a clone of the current version, which a counter
+ * renders as digits, so it reads back as a plain item. A table that shrank
+ * since the last batch is walked again from the start, one that grew goes
+ * on where it was; either way some items may be written twice, never
+ * skipped.
+ */
+void ebbrt::Memcached::SnapshotBatch(std::unique_ptr<SnapshotWalk> walk) {
+  auto again = [this](std::unique_ptr<SnapshotWalk> walk) {
+    event_manager->SpawnLocal(
+        [this, walk = std::move(walk)]() mutable {
+          SnapshotBatch(std::move(walk));
+        },
+        /* force_async = */ true);
+  };
+  auto &table = shards_[walk->shard]->table;
+  if (table.resizing()) {
+    again(std::move(walk));
+    return;
+  }
+  auto buckets = table.bucket_count();
+  if (buckets < walk->buckets) {
+    walk->bucket = 0;
+  }
+  walk->buckets = buckets;
+  auto now = cores_[size_t(Cpu::GetMine())]->now;
+  struct Item {
+    SnapshotRecord record;
+    std::unique_ptr<MutSharedIOBufRef> bytes;
+  };
+  std::vector<Item> items;
+  size_t total = 0;
+  walk->bucket =
+      table.Visit(walk->bucket, kSnapshotBatch, [&](TableEntry &entry) {
+        auto cur = entry.value.Current();
+        if (!Live(entry, now) || cur == nullptr) {
+          return;
+        }
+        Item item = {};
+        uint64_t version;
+        item.bytes = cur->Clone(&version);
+        item.record.len = item.bytes->ComputeChainDataLength();
+        item.record.expires = entry.expires.load(std::memory_order_relaxed);
+        item.record.key_len = entry.key.size();
+        total += (sizeof(SnapshotRecord) + item.record.len + 7) & ~size_t(7);
+        items.emplace_back(std::move(item));
+      });
+  if (total > 0) {
+    // zeroed, so the padding is too
+    auto chunk = MakeUniqueIOBuf(total, true);
+    auto dst = chunk->MutData();
+    for (auto &item : items) {
+      std::memcpy(dst, &item.record, sizeof(SnapshotRecord));
+      CopyChain(*item.bytes, 0, dst + sizeof(SnapshotRecord), item.record.len);
+      dst += (sizeof(SnapshotRecord) + item.record.len + 7) & ~size_t(7);
+    }
+    walk->items += items.size();
+    walk->sink(std::move(chunk));
+  }
+  if (walk->bucket == buckets) {
+    walk->shard++;
+    walk->bucket = 0;
+    walk->buckets = 0;
+    if (walk->shard == shards_.size()) {
+      walk->done(walk->items);
+      return;
+    }
+  }
+  again(std::move(walk));
+}
+
+bool ebbrt::Memcached::LoadSnapshot(const void *data, size_t len,
+                                    size_t *items) {
+  auto base = static_cast<const uint8_t *>(data);
+  *items = 0;
+  if (len < sizeof(SnapshotHeader)) {
+    return false;
+  }
+  auto h = reinterpret_cast<const SnapshotHeader *>(base);
+  if (h->magic != kSnapshotMagic || h->version != kSnapshotVersion) {
+    return false;
+  }
+  auto now = cores_[size_t(Cpu::GetMine())]->now;
+  auto off = sizeof(SnapshotHeader);
+  while (off < len) {
+    if (len - off < sizeof(SnapshotRecord)) {
+      return false;
+    }
+    auto r = reinterpret_cast<const SnapshotRecord *>(base + off);
+    auto bytes = base + off + sizeof(SnapshotRecord);
+    if (r->len > len - off - sizeof(SnapshotRecord) || r->key_len == 0 ||
+        r->key_len > KeyRef::kMaxLength ||
+        sizeof(uint32_t) + r->key_len > r->len) {
+      return false;
+    }
+    off += (sizeof(SnapshotRecord) + r->len + 7) & ~size_t(7);
+    if (r->expires != 0 && r->expires <= now) {
+      continue;
+    }
+    KeyRef key(boost::string_ref(
+        reinterpret_cast<const char *>(bytes) + sizeof(uint32_t), r->key_len));
+    auto copy = TightBuffer(slab_, r->len);
+    std::memcpy(copy->MutData(), bytes, r->len);
+    auto val = IOBuf::Create<VersionedResponse>(
+        NextCas(), SharedIOBufRef::CloneView, std::move(copy));
+    if (Restore(key, std::move(val), r->expires)) {
+      (*items)++;
+    }
+  }
+  return true;
+}
+
+void ebbrt::Memcached::Preload(
+    const void *data, size_t len,
+    std::function<void(size_t items, bool ok)> done) {
+  struct Load {
+    std::vector<const uint8_t *> blocks;
+    std::function<void(size_t, bool)> done;
+    size_t origin;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> items{0};
+    std::atomic<bool> ok{true};
+  };
+  auto load = std::make_shared<Load>();
+  load->done = std::move(done);
+  load->origin = size_t(Cpu::GetMine());
+  // find the blocks from their headers alone, the records are left to the
+  // core that stores them
+  auto base = static_cast<const uint8_t *>(data);
+  size_t off = 0;
+  while (off < len) {
+    DatasetBlock b;
+    if (len - off < sizeof(b)) {
+      load->ok = false;
+      break;
+    }
+    std::memcpy(&b, base + off, sizeof(b));
+    if (b.magic != kDatasetMagic || b.bytes > len - off - sizeof(b)) {
+      load->ok = false;
+      break;
+    }
+    load->blocks.push_back(base + off);
+    off += sizeof(b) + b.bytes;
+  }
+  auto n = cores_.size();
+  load->pending = n;
+  for (size_t i = 0; i < n; i++) {
+    auto first = load->blocks.size() * i / n;
+    auto last = load->blocks.size() * (i + 1) / n;
+    event_manager->SpawnRemote(
+        [this, load, first, last]() {
+          size_t items = 0;
+          for (auto k = first; k < last; k++) {
+            if (!PreloadBlock(load->blocks[k], &items)) {
+              load->ok = false;
+              break;
+            }
+          }
+          load->items += items;
+          if (load->pending.fetch_sub(1) == 1) {
+            event_manager->SpawnRemote(
+                [load]() { load->done(load->items, load->ok); },
+                load->origin);
+          }
+        },
+        i);
+  }
+}
+
+/**
+ * PreloadBlock() - store the records of one dataset block, each copied
+ * straight into a new version. Returns false if a record overruns the
+ * block or has no valid key.
+ */
+bool ebbrt::Memcached::PreloadBlock(const uint8_t *block, size_t *items) {
+  DatasetBlock b;
+  std::memcpy(&b, block, sizeof(b));
+  auto p = block + sizeof(b);
+  auto end = p + b.bytes;
+  auto now = cores_[size_t(Cpu::GetMine())]->now;
+  for (uint32_t i = 0; i < b.records; i++) {
+    DatasetRecord r;
+    if (size_t(end - p) < sizeof(r)) {
+      return false;
+    }
+    std::memcpy(&r, p, sizeof(r));
+    p += sizeof(r);
+    if (r.key_len == 0 || r.key_len > KeyRef::kMaxLength ||
+        size_t(end - p) < size_t(r.key_len) + r.value_len) {
+      return false;
+    }
+    KeyRef key(boost::string_ref(reinterpret_cast<const char *>(p), r.key_len));
+    // stored as <flags,key,value>, flags in network byte order
+    auto hlen = sizeof(uint32_t) + r.key_len;
+    auto copy = TightBuffer(slab_, hlen + r.value_len);
+    auto dst = copy->MutData();
+    auto flags = htonl(r.flags);
+    std::memcpy(dst, &flags, sizeof(flags));
+    std::memcpy(dst + sizeof(flags), p, r.key_len + r.value_len);
+    p += r.key_len + r.value_len;
+    auto val = IOBuf::Create<VersionedResponse>(
+        NextCas(), SharedIOBufRef::CloneView, std::move(copy));
+    if (Restore(key, std::move(val), ExpiryTime(r.exptime, now))) {
+      (*items)++;
+    }
+  }
+  return true;
+}
+
+/**
+ * Restore() - store val as a new entry on this core unless the key is
+ * live, for loading items that were stored before. Returns whether it was.
+ */
+bool ebbrt::Memcached::Restore(const KeyRef &key,
+                               std::unique_ptr<VersionedResponse> val,
+                               uint32_t expires) {
+  auto mycpu = size_t(Cpu::GetMine());
+  auto now = cores_[mycpu]->now;
+  auto &shard = ShardFor(key.hash);
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(shard.lock);
+    auto p = shard.table.find(key.key, key.hash);
+    if (p && Live(*p, now)) {
+      return false;
+    }
+    if (p) {
+      auto &owner = *cores_[p->owner];
+      std::lock_guard<ebbrt::SpinLock> core_guard(owner.lock);
+      if (p->clock_hook.is_linked()) {
+        Unlink(*p, shard, owner);
+      }
+    }
+    auto entry = TableEntry::Create(slab_, shard, key.key, std::move(val),
+                                    mycpu, expires, Generation(now));
+    shard.table.insert(*entry, key.hash);
+    Track(*entry);
+    MaybeResize(shard);
+  }
+  Reclaim();
+  return true;
+}
+
+/**
+ * Retire() - free an entry already unlinked from its table and its owner's
+ * lists once every core has passed a quiescent state.
+ */
+void ebbrt::Memcached::Retire(TableEntry &entry) {
+  // take the value out first: a write racing with the unlink then finds
+  // nothing to replace and stores a new entry instead
+  Release(entry.owner, entry.value.Swap(nullptr));
+  event_manager->DoRcu([this, &entry]() {
+    Uncharge(entry.owner, entry.Footprint(), entry.Held());
+    TableEntry::Destroy(&entry);
+  });
+}
+
+void ebbrt::Memcached::Quit() {
+  return;
+}
+
+/**
+ * Flush() - invalidate every item, now or at exptime (relative or absolute
+ * as for items), in constant time. Entries carry the generation they were
+ * stored in and Live() checks it against the flush, so nothing is touched
+ * here; each core's reaper sweeps out its dead entries once the flush is in
+ * force. A flush replaces a delayed one that is still pending.
+ */
+void ebbrt::Memcached::Flush(uint32_t exptime) {
+  auto now = cores_[size_t(Cpu::GetMine())]->now;
+  // an immediate flush is in force for every core whatever its clock says
+  auto deadline = ExpiryTime(exptime, now);
+  std::lock_guard<ebbrt::SpinLock> guard(flush_lock_);
+  auto flush = flush_.load(std::memory_order_relaxed);
+  auto gen = uint32_t(flush);
+  if (now >= uint32_t(flush >> 32)) {
+    // the previous flush is in force, keep its entries dead
+    flushed_below_.store(gen + 1, std::memory_order_relaxed);
+    gen++;
+  }
+  flush_.store(uint64_t(deadline) << 32 | gen, std::memory_order_release);
+}
+
+static const char *const ascii_reply[] = { "VALUE ", "STORED\r\n",
+                                           "NOT_STORED\r\n", "EXISTS\r\n",
+                                           "NOT_FOUND\r\n", "DELETED", "TOUCHED"
+                                                                       "ERROR",
+                                           "END", "CLIENT_ERROR",
+                                           "SERVER_ERROR" };
+
+uint16_t ebbrt::Memcached::BinaryStatus(Result res) {
+  switch (res) {
+  case Result::kOk:
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+  case Result::kNotStored:
+    return PROTOCOL_BINARY_RESPONSE_NOT_STORED;
+  case Result::kExists:
+    return PROTOCOL_BINARY_RESPONSE_KEY_EEXISTS;
+  case Result::kNotFound:
+    return PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+  case Result::kNonNumeric:
+    break;
+  }
+  return PROTOCOL_BINARY_RESPONSE_DELTA_BADVAL;
+}
+
+const char *ebbrt::Memcached::com2str(uint8_t cmd) {
+  static const char *const text[] = {
+    "GET",       "SET",      "ADD",     "REPLACE",    "DELETE",     "INCREMENT",
+    "DECREMENT", "QUIT",     "FLUSH",   "GETQ",       "NOOP",       "VERSION",
+    "GETK",      "GETKQ",    "APPEND",  "PREPEND",    "STAT",       "SETQ",
+    "ADDQ",      "REPLACEQ", "DELETEQ", "INCREMENTQ", "DECREMENTQ", "QUITQ",
+    "FLUSHQ",    "APPENDQ",  "PREPENDQ"
+  };
+  if (cmd <= PROTOCOL_BINARY_CMD_PREPENDQ) {
+    return text[cmd];
+  }
+  return nullptr;
+}
+
+void ebbrt::Memcached::Nop(protocol_binary_request_header &h) {
+  const char *cmd = com2str(h.request.opcode);
+  kprintf("%s CMD IS NOP\n", cmd);
+}
+
+/**
+ * ProcessAscii() - keys and numbers are parsed straight out of the command
+ * line and storage commands hand the receive chain to the store as the
+ * value, so nothing is copied on the way in.
+ */
+std::unique_ptr<ebbrt::MutIOBuf>
+ebbrt::Memcached::ProcessAscii(std::unique_ptr<IOBuf> msg,
+                               boost::string_ref line, Sample *sample) {
+  auto rest = line;
+  auto cmd = NextToken(rest);
+  Sample ignored;
+  if (sample == nullptr) {
+    sample = &ignored;
+  }
+  auto count = [this, sample](uint8_t opcode) {
+    Count(opcode);
+    sample->opcode = opcode;
+  };
+  auto reply = [](Result res, const char *ok) {
+    switch (res) {
+    case Result::kOk:
+      return AsciiReply(ok);
+    case Result::kNotStored:
+      return AsciiReply("NOT_STORED\r\n");
+    case Result::kExists:
+      return AsciiReply("EXISTS\r\n");
+    case Result::kNotFound:
+      return AsciiReply("NOT_FOUND\r\n");
+    case Result::kNonNumeric:
+      break;
+    }
+    return AsciiReply(
+        "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n");
+  };
+  if (cmd == "get" || cmd == "gets") {
+    count(PROTOCOL_BINARY_CMD_GET);
+    return AsciiGet(rest, cmd == "gets", &sample->miss);
+  }
+  if (IsStorageCommand(cmd)) {
+    auto key = NextToken(rest);
+    uint32_t flags, bytes, exptime_raw;
+    auto flags_tok = NextToken(rest);
+    auto exptime_tok = NextToken(rest);
+    auto bytes_tok = NextToken(rest);
+    // cas <key> <flags> <exptime> <bytes> <cas unique> [noreply]
+    uint64_t cas = 0;
+    bool cas_ok = cmd != "cas" || (ParseU64(NextToken(rest), &cas) && cas);
+    auto noreply = NextToken(rest) == "noreply";
+    // negative expiration times mean already expired
+    bool expired = exptime_tok.size() > 1 && exptime_tok[0] == '-' &&
+                   ParseU32(exptime_tok.substr(1), &exptime_raw);
+    if (key.empty() || key.size() > KeyRef::kMaxLength || !cas_ok ||
+        !ParseU32(flags_tok, &flags) || !ParseU32(bytes_tok, &bytes) ||
+        (!expired && !ParseU32(exptime_tok, &exptime_raw))) {
+      return AsciiReply("CLIENT_ERROR bad command line format\r\n");
+    }
+    auto exptime = expired ? kRelativeExpiryMax + 1 : exptime_raw;
+    auto len = msg->ComputeChainDataLength();
+    auto offset = len - bytes - 2;
+    char crlf[2];
+    CopyChain(*msg, offset + bytes, reinterpret_cast<uint8_t *>(crlf), 2);
+    if (crlf[0] != '\r' || crlf[1] != '\n') {
+      return AsciiReply("CLIENT_ERROR bad data chunk\r\n");
+    }
+    // line may point into msg, nothing below may look at it
+    Value v{std::move(msg), offset, bytes, htonl(flags)};
+    Result res;
+    if (cmd == "append" || cmd == "prepend") {
+      count(cmd == "append" ? PROTOCOL_BINARY_CMD_APPEND
+                            : PROTOCOL_BINARY_CMD_PREPEND);
+      // flags and exptime are ignored, the item keeps its own
+      res = Concat(std::move(v), KeyRef(key), cmd == "append");
+    } else {
+      auto mode = StoreMode::kSet;
+      if (cmd == "add") {
+        count(PROTOCOL_BINARY_CMD_ADD);
+        mode = StoreMode::kAdd;
+      } else if (cmd == "replace") {
+        count(PROTOCOL_BINARY_CMD_REPLACE);
+        mode = StoreMode::kReplace;
+      } else {
+        count(PROTOCOL_BINARY_CMD_SET);
+      }
+      res = Set(std::move(v), KeyRef(key), exptime, mode, &cas);
+    }
+    sample->miss = res != Result::kOk;
+    if (noreply) {
+      return nullptr;
+    }
+    return reply(res, "STORED\r\n");
+  }
+  if (cmd == "delete") {
+    count(PROTOCOL_BINARY_CMD_DELETE);
+    auto key = NextToken(rest);
+    auto noreply = NextToken(rest) == "noreply";
+    if (key.empty() || key.size() > KeyRef::kMaxLength) {
+      return AsciiReply("CLIENT_ERROR bad command line format\r\n");
+    }
+    auto res = Delete(KeyRef(key));
+    sample->miss = res != Result::kOk;
+    if (noreply) {
+      return nullptr;
+    }
+    return reply(res, "DELETED\r\n");
+  }
+  if (cmd == "incr" || cmd == "decr") {
+    count(cmd == "incr" ? PROTOCOL_BINARY_CMD_INCREMENT
+                        : PROTOCOL_BINARY_CMD_DECREMENT);
+    auto key = NextToken(rest);
+    uint64_t delta, result;
+    auto delta_tok = NextToken(rest);
+    auto noreply = NextToken(rest) == "noreply";
+    if (key.empty() || key.size() > KeyRef::kMaxLength) {
+      return AsciiReply("CLIENT_ERROR bad command line format\r\n");
+    }
+    if (!ParseU64(delta_tok, &delta)) {
+      return AsciiReply("CLIENT_ERROR invalid numeric delta argument\r\n");
+    }
+    auto res = Arith(KeyRef(key), cmd == "incr", delta, &result);
+    sample->miss = res != Result::kOk;
+    if (noreply) {
+      return nullptr;
+    }
+    if (res != Result::kOk) {
+      return reply(res, nullptr);
+    }
+    char num[24];
+    auto n =
+        snprintf(num, sizeof(num), "%llu\r\n", (unsigned long long)result);
+    return AsciiReply(boost::string_ref(num, n));
+  }
+  if (cmd == "stats") {
+    count(PROTOCOL_BINARY_CMD_STAT);
+    return AsciiStats(NextToken(rest));
+  }
+  if (cmd == "flush_all") {
+    // flush_all [delay] [noreply]
+    count(PROTOCOL_BINARY_CMD_FLUSH);
+    auto tok = NextToken(rest);
+    uint32_t delay = 0;
+    if (!tok.empty() && tok != "noreply") {
+      if (!ParseU32(tok, &delay)) {
+        return AsciiReply("CLIENT_ERROR bad command line format\r\n");
+      }
+      tok = NextToken(rest);
+    }
+    Flush(delay);
+    if (tok == "noreply") {
+      return nullptr;
+    }
+    return AsciiReply("OK\r\n");
+  }
+  if (cmd == "quit") {
+    count(PROTOCOL_BINARY_CMD_QUIT);
+    Quit();
+    return nullptr;
+  }
+  return AsciiReply("ERROR\r\n");
+}
+
+/**
+ * AsciiGet() - one VALUE line per hit, each followed by a reference to the
+ * stored value itself. The "\r\n" closing a value is carried at the front
+ * of the next line so each hit costs a single small buffer. miss is set if
+ * any key missed.
+ */
+std::unique_ptr<ebbrt::MutIOBuf>
+ebbrt::Memcached::AsciiGet(boost::string_ref keys, bool cas, bool *miss) {
+  // "\r\n" VALUE <key> <flags> <bytes> [<cas>] "\r\n"
+  static const constexpr size_t kValueLineMax = 64 + KeyRef::kMaxLength;
+  std::unique_ptr<MutIOBuf> reply;
+  const char *sep = "";
+  for (auto key = NextToken(keys); !key.empty(); key = NextToken(keys)) {
+    if (key.size() > KeyRef::kMaxLength) {
+      return AsciiReply("CLIENT_ERROR bad command line format\r\n");
+    }
+    auto res = Get(KeyRef(key));
+    if (!res) {
+      *miss = true;
+      continue;
+    }
+    // stored as <flags,key,value>
+    uint64_t version;
+    std::unique_ptr<IOBuf> val = res->Clone(&version);
+    uint32_t flags;
+    CopyChain(*val, 0, reinterpret_cast<uint8_t *>(&flags), sizeof(flags));
+    auto hlen = sizeof(flags) + key.size();
+    auto len = val->ComputeChainDataLength() - hlen;
+    val->AdvanceChain(hlen);
+    while (val->Length() == 0 && val->IsChained()) {
+      val = val->Pop();
+    }
+    auto hdr = MakeUniqueIOBuf(kValueLineMax);
+    char cas_str[24] = "";
+    if (cas) {
+      snprintf(cas_str, sizeof(cas_str), " %llu",
+               (unsigned long long)version);
+    }
+    auto n = snprintf(reinterpret_cast<char *>(hdr->MutData()), kValueLineMax,
+                      "%sVALUE %.*s %u %zu%s\r\n", sep, int(key.size()),
+                      key.data(), ntohl(flags), len, cas_str);
+    hdr->TrimEnd(kValueLineMax - n);
+    hdr->PrependChain(std::move(val));
+    AppendReply(reply, std::move(hdr));
+    sep = "\r\n";
+  }
+  AppendReply(reply, AsciiReply(*sep ? "\r\nEND\r\n" : "END\r\n"));
+  return reply;
+}
+
+/**
+ * Stats() - the statistics of a STAT group: the general ones for an empty
+ * group, "items" per owning core, since items belong to the core that
+ * stored them rather than to a slab class, "hotkeys" the keys replicated
+ * on each core, "latency" percentiles per opcode and outcome, and "slabs"
+ * per size class. Returns false for a group we do not know.
+ */
+bool ebbrt::Memcached::Stats(boost::string_ref group, StatList *stats) {
+  auto add = [stats](std::string name, uint64_t val) {
+    stats->emplace_back(std::move(name), std::to_string(val));
+  };
+  if (group.empty()) {
+    auto u = GetUsage();
+    auto now = CurrentTime();
+    add("uptime", now - start_time_);
+    add("time", now);
+    add("pointer_size", 8 * sizeof(void *));
+    add("threads", cores_.size());
+    add("curr_connections", u.curr_connections);
+    add("total_connections", u.total_connections);
+    add("cmd_get", u.cmds[PROTOCOL_BINARY_CMD_GET] +
+                       u.cmds[PROTOCOL_BINARY_CMD_GETQ] +
+                       u.cmds[PROTOCOL_BINARY_CMD_GETK] +
+                       u.cmds[PROTOCOL_BINARY_CMD_GETKQ]);
+    add("cmd_set", u.cmds[PROTOCOL_BINARY_CMD_SET] +
+                       u.cmds[PROTOCOL_BINARY_CMD_SETQ] +
+                       u.cmds[PROTOCOL_BINARY_CMD_ADD] +
+                       u.cmds[PROTOCOL_BINARY_CMD_ADDQ] +
+                       u.cmds[PROTOCOL_BINARY_CMD_REPLACE] +
+                       u.cmds[PROTOCOL_BINARY_CMD_REPLACEQ] +
+                       u.cmds[PROTOCOL_BINARY_CMD_APPEND] +
+                       u.cmds[PROTOCOL_BINARY_CMD_APPENDQ] +
+                       u.cmds[PROTOCOL_BINARY_CMD_PREPEND] +
+                       u.cmds[PROTOCOL_BINARY_CMD_PREPENDQ]);
+    add("cmd_flush", u.cmds[PROTOCOL_BINARY_CMD_FLUSH] +
+                         u.cmds[PROTOCOL_BINARY_CMD_FLUSHQ]);
+    add("get_hits", u.hits);
+    add("get_misses", u.misses);
+    add("bytes_read", u.bytes_read);
+    add("bytes_written", u.bytes_written);
+    add("replies", u.replies);
+    add("reply_segments", u.reply_segments);
+    add("reply_allocs", u.reply_allocs);
+    add("udp_datagrams_received", u.udp_received);
+    add("udp_datagrams_sent", u.udp_sent);
+    add("udp_datagrams_dropped", u.udp_dropped);
+    add("limit_maxbytes", u.limit_bytes);
+    add("curr_items", u.items);
+    add("total_items", u.sets);
+    add("bytes", u.resident_bytes);
+    add("bytes_held", u.held_bytes);
+    add("bytes_set", u.set_bytes);
+    add("evictions", u.evictions);
+    add("hash_buckets", u.buckets);
+    add("hot_keys", u.hot_keys);
+    add("replica_hits", u.replica_hits);
+    add("replica_copies", u.replica_copies);
+    for (size_t i = 0; i <= PROTOCOL_BINARY_CMD_PREPENDQ; i++) {
+      if (u.cmds[i] == 0) {
+        continue;
+      }
+      std::string name = "cmd_op_";
+      for (auto c = com2str(i); *c; c++) {
+        name += std::tolower(*c);
+      }
+      add(std::move(name), u.cmds[i]);
+    }
+    return true;
+  }
+  if (group == "items") {
+    for (size_t i = 0; i < cores_.size(); i++) {
+      auto &core = *cores_[i];
+      auto prefix = "items:" + std::to_string(i) + ":";
+      add(prefix + "number", core.items);
+      add(prefix + "bytes",
+          core.resident_bytes.load(std::memory_order_relaxed));
+      add(prefix + "bytes_held",
+          core.held_bytes.load(std::memory_order_relaxed));
+      add(prefix + "evicted", core.stats.evictions);
+    }
+    return true;
+  }
+  if (group == "cores") {
+    // utilization in per mille of the time spent in Receive()
+    for (size_t i = 0; i < cores_.size(); i++) {
+      auto &load = cores_[i]->load;
+      auto prefix = "core:" + std::to_string(i) + ":";
+      add(prefix + "connections",
+          load.sessions.load(std::memory_order_relaxed));
+      add(prefix + "utilization",
+          load.utilization.load(std::memory_order_relaxed));
+      add(prefix + "requests_per_sec", load.request_rate);
+      add(prefix + "migrated_out", load.migrated_out);
+    }
+    return true;
+  }
+  if (group == "hotkeys") {
+    // GETs each replica served over the last tick
+    for (size_t i = 0; i < cores_.size(); i++) {
+      auto &core = *cores_[i];
+      auto prefix = "hot:" + std::to_string(i) + ":";
+      std::lock_guard<ebbrt::SpinLock> guard(core.lock);
+      for (auto &key : core.hot) {
+        add(prefix + key.first, key.second);
+      }
+    }
+    return true;
+  }
+  if (group == "latency") {
+    // nanoseconds from receive to send, merged over all cores
+    for (size_t miss = 0; miss < 2; miss++) {
+      for (size_t i = 0; i <= PROTOCOL_BINARY_CMD_PREPENDQ; i++) {
+        LatencyHistogram hist;
+        for (auto &core : cores_) {
+          if (auto &h = core->stats.latency[miss][i]) {
+            hist.Merge(*h);
+          }
+        }
+        if (hist.Count() == 0) {
+          continue;
+        }
+        std::string prefix = "latency:";
+        for (auto c = com2str(i); *c; c++) {
+          prefix += std::tolower(*c);
+        }
+        prefix += miss ? ":miss:" : ":hit:";
+        add(prefix + "count", hist.Count());
+        add(prefix + "p50", hist.Percentile(50));
+        add(prefix + "p90", hist.Percentile(90));
+        add(prefix + "p99", hist.Percentile(99));
+        add(prefix + "p999", hist.Percentile(99.9));
+        add(prefix + "max", hist.Max());
+      }
+    }
+    return true;
   }
-  return std::move(ret);
+  if (group == "slabs") {
+    auto slab = slab_.GetStats();
+    size_t active = 0;
+    for (size_t c = 0; c < SlabAllocator::kNumClasses; c++) {
+      if (slab.class_slabs[c] == 0) {
+        continue;
+      }
+      active++;
+      size_t chunk_size = size_t(1) << (SlabAllocator::kMinShift + c);
+      auto prefix = std::to_string(c) + ":";
+      add(prefix + "chunk_size", chunk_size);
+      add(prefix + "total_pages", slab.class_slabs[c]);
+      add(prefix + "total_chunks", slab.class_slabs[c] *
+                                       (SlabAllocator::kSlabSize / chunk_size));
+      add(prefix + "allocs", slab.class_allocs[c]);
+    }
+    add("active_slabs", active);
+    add("total_malloced", slab.slab_bytes);
+    add("allocs", slab.allocs);
+    add("frees", slab.frees);
+    add("remote_frees", slab.remote_frees);
+    return true;
+  }
+  return false;
 }
 
-std::unique_ptr<ebbrt::MutSharedIOBufRef>
-ebbrt::Memcached::GetResponse::CreateBinaryResponse(std::unique_ptr<IOBuf> b) {
-  auto bptr = b.get();
-  auto remainder = b->Next();
-  auto ret =
-      IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView, std::move(b));
-  while (remainder != bptr) {
-    auto next = remainder->Next();
-    auto ref = IOBuf::Create<IOBufRef>(IOBufRef::CloneView, *remainder);
-    ret->PrependChain(std::move(ref));
-    remainder = next;
-  }
-  ret->AdvanceChain(sizeof(protocol_binary_request_header));
-  // clear extras of set msg
-  auto md = ret->GetMutDataPointer();
-  for (size_t i = 0; i < sizeof(uint32_t); i++) {
-    md.Get<uint8_t>() = 0;
+std::unique_ptr<ebbrt::MutIOBuf>
+ebbrt::Memcached::AsciiStats(boost::string_ref group) {
+  StatList stats;
+  if (!Stats(group, &stats)) {
+    return AsciiReply("ERROR\r\n");
   }
-  ret->AdvanceChain(sizeof(uint32_t));
-  return ret;
+  std::string out;
+  for (auto &stat : stats) {
+    out += "STAT " + stat.first + " " + stat.second + "\r\n";
+  }
+  out += "END\r\n";
+  return AsciiReply(out);
 }
 
-std::unique_ptr<ebbrt::MutSharedIOBufRef>
-ebbrt::Memcached::GetResponse::Swap(std::unique_ptr<MutSharedIOBufRef> b) {
-  return binary_response_.exchange(b.release());
+/**
+ * Count() - one more request with the given binary opcode on this core
+ */
+void ebbrt::Memcached::Count(uint8_t opcode) {
+  if (likely(opcode <= PROTOCOL_BINARY_CMD_PREPENDQ)) {
+    cores_[size_t(Cpu::GetMine())]->stats.cmds[opcode]++;
+  }
 }
 
-ebbrt::Memcached::GetResponse *ebbrt::Memcached::Get(std::unique_ptr<IOBuf> b,
-                                                     std::string key) {
-  auto p = table_.find(key);
-  if (!p) {
-    // cache miss
-    return nullptr;
-  } else {
-    // cache hit
-    return &(p->value);
+/**
+ * RecordLatency() - file n requests that started at start as done now. A
+ * receive burst shares one clock read, so this costs a bucket increment
+ * per request.
+ */
+void ebbrt::Memcached::RecordLatency(const Sample *samples, size_t n,
+                                     clock::Wall::time_point start) {
+  if (n == 0) {
+    return;
+  }
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    clock::Wall::Now() - start)
+                    .count();
+  auto &stats = cores_[size_t(Cpu::GetMine())]->stats;
+  for (size_t i = 0; i < n; i++) {
+    if (unlikely(samples[i].opcode > PROTOCOL_BINARY_CMD_PREPENDQ)) {
+      continue;
+    }
+    auto &hist = stats.latency[samples[i].miss][samples[i].opcode];
+    if (unlikely(!hist)) {
+      hist.reset(new LatencyHistogram());
+    }
+    hist->Record(ns);
   }
 }
 
-void ebbrt::Memcached::Set(std::unique_ptr<IOBuf> b, std::string key) {
-  auto p = table_.find(key);
-  if (!p) {
-    // Double check that there is no matching key while holding the lock
-    std::lock_guard<ebbrt::SpinLock> guard(table_lock_);
-    p = table_.find(key);
-    if (!p) {
-      table_.insert(*new TableEntry(key, std::move(b)));
-      return;
+void ebbrt::Memcached::Start(uint16_t port) {
+  if (report_interval_.count() > 0) {
+    timer->Start(reporter_,
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     report_interval_),
+                 /* repeat = */ true);
+  }
+  // every core ticks its own expiry wheel
+  for (size_t i = 0; i < cores_.size(); i++) {
+    event_manager->SpawnRemote(
+        [this, i]() {
+          timer->Start(cores_[i]->reaper, std::chrono::seconds(1),
+                       /* repeat = */ true);
+        },
+        i);
+  }
+  listening_pcb_.Bind(port, [this](NetworkManager::TcpPcb pcb) {
+    // new connection callback
+    static std::atomic<size_t> cpu_index{0};
+    cores_[size_t(Cpu::GetMine())]->stats.conns_opened++;
+    size_t index;
+    if (placement_ == Placement::kLeastLoaded) {
+      index = LeastLoaded();
+    } else {
+      index = cpu_index.fetch_add(1) % ebbrt::Cpu::Count();
     }
-    // fallthrough if we found the key on the double check
+    cores_[index]->load.sessions.fetch_add(1, std::memory_order_relaxed);
+    pcb.BindCpu(index);
+    auto connection = new TcpSession(this, std::move(pcb));
+    connection->Install();
+  });
+  if (udp_port_ != 0) {
+    udp_pcb_.Bind(udp_port_);
+    udp_pcb_.Receive([this](Ipv4Address from, uint16_t port,
+                            std::unique_ptr<MutIOBuf> buf) {
+      ReceiveUdp(from, port, std::move(buf));
+    });
   }
-  auto new_val =
-      ebbrt::Memcached::GetResponse::CreateBinaryResponse(std::move(b));
-  auto old_val = p->value.Swap(std::move(new_val));
-  // We must wait an RCU generation here because a concurrent GET
-  // may be constructing it's response.
-  event_manager->DoRcu([ old = std::move(old_val) ]() mutable {});
 }
 
-void ebbrt::Memcached::Quit() {
-  return;
+/** UdpServed() - whether opcode is answered over UDP */
+bool ebbrt::Memcached::UdpServed(uint8_t opcode) {
+  switch (opcode) {
+  case PROTOCOL_BINARY_CMD_GET:
+  case PROTOCOL_BINARY_CMD_GETQ:
+  case PROTOCOL_BINARY_CMD_GETK:
+  case PROTOCOL_BINARY_CMD_GETKQ:
+  case PROTOCOL_BINARY_CMD_NOOP:
+    return true;
+  default:
+    return false;
+  }
 }
 
-void ebbrt::Memcached::Flush() {
-  std::lock_guard<ebbrt::SpinLock> guard(table_lock_);
-  table_.clear();
-  return;
-}
+/**
+ * ReceiveUdp() - answer one datagram on the core it arrived on. As in
+ * memcached, a request datagram stands alone: it holds whole binary
+ * requests, which are run as one batch like a TCP receive. Requests other
+ * than the GET family fail with UNKNOWN_COMMAND, text ones are dropped.
+ */
+void ebbrt::Memcached::ReceiveUdp(Ipv4Address from, uint16_t port,
+                                  std::unique_ptr<MutIOBuf> buf) {
+  auto &core = *cores_[size_t(Cpu::GetMine())];
+  auto &stats = core.stats;
+  auto start = clock::Wall::Now();
+  auto len = buf->ComputeChainDataLength();
+  stats.udp_received++;
+  stats.bytes_read += len;
+  if (len <= sizeof(UdpFrame)) {
+    stats.udp_dropped++;
+    return;
+  }
+  auto frame = buf->GetDataPointer().Get<UdpFrame>();
+  if (frame.sequence != 0 || ntohs(frame.datagrams) != 1) {
+    stats.udp_dropped++;
+    return;
+  }
+  buf->AdvanceChain(sizeof(UdpFrame));
 
-static const char *const ascii_reply[] = { "VALUE ", "STORED\r\n",
-                                           "NOT_STORED\r\n", "EXISTS\r\n",
-                                           "NOT_FOUND\r\n", "DELETED", "TOUCHED"
-                                                                       "ERROR",
-                                           "END", "CLIENT_ERROR",
-                                           "SERVER_ERROR" };
+  Framer framer;
+  framer.Append(std::move(buf));
+  auto &reply = core.udp_reply;
+  auto tracking = track_latency_;
+  std::unique_ptr<IOBuf> batch[kMaxBatch];
+  size_t batch_len = 0;
+  // filed once the reply is sent, unless more arrive than there is room
+  Sample done[kMaxBatch];
+  size_t ndone = 0;
+  auto run_batch = [&]() {
+    if (!tracking) {
+      ProcessBinaryBatch(batch, batch_len, reply);
+    } else {
+      if (ndone + batch_len > kMaxBatch) {
+        RecordLatency(done, ndone, start);
+        ndone = 0;
+      }
+      ProcessBinaryBatch(batch, batch_len, reply, done + ndone);
+      ndone += batch_len;
+    }
+    batch_len = 0;
+  };
+  bool ascii;
+  boost::string_ref line;
+  while (auto msg = framer.Next(&ascii, &line)) {
+    if (ascii) {
+      continue;
+    }
+    auto h = msg->GetDataPointer().Get<protocol_binary_request_header>();
+    if (!UdpServed(h.request.opcode)) {
+      // replies go out in request order
+      run_batch();
+      auto rhead = reply.Header();
+      rhead->response.magic = PROTOCOL_BINARY_RES;
+      rhead->response.opcode = h.request.opcode;
+      rhead->response.opaque = h.request.opaque;
+      rhead->response.status =
+          htons(PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND);
+      reply.Complete(nullptr);
+      continue;
+    }
+    batch[batch_len++] = std::move(msg);
+    if (batch_len == kMaxBatch) {
+      run_batch();
+    }
+  }
+  run_batch();
+  auto rbuf = reply.Finish(&stats.replies);
+  if (rbuf) {
+    SendUdp(from, port, frame.request_id, std::move(rbuf));
+  }
+  if (tracking) {
+    RecordLatency(done, ndone, start);
+  }
+  core.load.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           clock::Wall::Now() - start)
+                           .count();
+}
 
-const char *ebbrt::Memcached::com2str(uint8_t cmd) {
-  static const char *const text[] = {
-    "GET",       "SET",      "ADD",     "REPLACE",    "DELETE",     "INCREMENT",
-    "DECREMENT", "QUIT",     "FLUSH",   "GETQ",       "NOOP",       "VERSION",
-    "GETK",      "GETKQ",    "APPEND",  "PREPEND",    "STAT",       "SETQ",
-    "ADDQ",      "REPLACEQ", "DELETEQ", "INCREMENTQ", "DECREMENTQ", "QUITQ",
-    "FLUSHQ",    "APPENDQ",  "PREPENDQ"
+/**
+ * SendUdp() - send reply in datagrams of up to kUdpPayload bytes, each a
+ * single buffer holding its frame and its share of the reply copied in
+ */
+void ebbrt::Memcached::SendUdp(Ipv4Address to, uint16_t port,
+                               uint16_t request_id,
+                               std::unique_ptr<IOBuf> reply) {
+  auto &stats = cores_[size_t(Cpu::GetMine())]->stats;
+  const auto per = kUdpPayload - sizeof(UdpFrame);
+  auto left = reply->ComputeChainDataLength();
+  auto datagrams = (left + per - 1) / per;
+  if (unlikely(datagrams > UINT16_MAX)) {
+    stats.udp_dropped++;
+    return;
+  }
+  std::unique_ptr<MutIOBuf> dgram;
+  uint16_t sequence = 0;
+  auto send = [&]() {
+    stats.udp_sent++;
+    stats.bytes_written += dgram->Length();
+    udp_pcb_.SendTo(to, port, std::move(dgram));
   };
-  if (cmd <= PROTOCOL_BINARY_CMD_PREPENDQ) {
-    return text[cmd];
+  for (auto &b : *reply) {
+    auto src = b.Data();
+    auto len = b.Length();
+    while (len > 0) {
+      if (!dgram || dgram->Tailroom() == 0) {
+        if (dgram) {
+          send();
+        }
+        auto size = sizeof(UdpFrame) + (left < per ? left : per);
+        dgram = MakeUniqueIOBuf(size);
+        dgram->TrimEnd(size);
+        UdpFrame frame = {request_id, htons(sequence++), htons(datagrams), 0};
+        std::memcpy(dgram->MutTail(), &frame, sizeof(frame));
+        dgram->Append(sizeof(frame));
+      }
+      auto n = len < dgram->Tailroom() ? len : dgram->Tailroom();
+      std::memcpy(dgram->MutTail(), src, n);
+      dgram->Append(n);
+      src += n;
+      len -= n;
+      left -= n;
+    }
+  }
+  if (dgram) {
+    send();
   }
-  return nullptr;
 }
 
-void ebbrt::Memcached::Nop(protocol_binary_request_header &h) {
-  const char *cmd = com2str(h.request.opcode);
-  kprintf("%s CMD IS NOP\n", cmd);
+void ebbrt::Memcached::TcpSession::Close() {
+  auto &core = *mcd_->cores_[size_t(Cpu::GetMine())];
+  core.stats.conns_closed++;
+  core.load.sessions.fetch_sub(1, std::memory_order_relaxed);
 }
 
-void ebbrt::Memcached::Unimplemented(protocol_binary_request_header &h) {
-  const char *cmd = com2str(h.request.opcode);
-  kbugon(true, "%s CMD IS UNSUPPORTED. ABORTING...\n", cmd);
+void ebbrt::Memcached::TcpSession::Abort() {
+  auto &core = *mcd_->cores_[size_t(Cpu::GetMine())];
+  core.stats.conns_closed++;
+  core.load.sessions.fetch_sub(1, std::memory_order_relaxed);
 }
 
-void ebbrt::Memcached::Start(uint16_t port) {
-  listening_pcb_.Bind(port, [this](NetworkManager::TcpPcb pcb) {
-    // new connection callback
-    static std::atomic<size_t> cpu_index{0};
-    auto index = cpu_index.fetch_add(1) % ebbrt::Cpu::Count();
-    pcb.BindCpu(index);
-    auto connection = new TcpSession(this, std::move(pcb));
-    connection->Install();
-  });
+/**
+ * Rebalance() - at the end of a receive on a core that is shedding load, a
+ * connection that sent at least its share of the core's requests in the
+ * last tick moves to the least loaded core
+ */
+void ebbrt::Memcached::TcpSession::Rebalance(CoreStore &core) {
+  auto &load = core.load;
+  auto sessions = load.sessions.load(std::memory_order_relaxed);
+  if (last_requests_ == 0 ||
+      last_requests_ * sessions < load.window_requests) {
+    return;
+  }
+  auto mycpu = size_t(Cpu::GetMine());
+  auto target = mcd_->LeastLoaded();
+  if (target == mycpu) {
+    return;
+  }
+  load.shed--;
+  load.migrated_out++;
+  load.sessions.fetch_sub(1, std::memory_order_relaxed);
+  mcd_->cores_[target]->load.sessions.fetch_add(1, std::memory_order_relaxed);
+  // every request framed so far has been answered, receives from here on
+  // are delivered to the target core
+  TcpHandler::pcb_.BindCpu(target);
 }
 
 void ebbrt::Memcached::TcpSession::Receive(std::unique_ptr<MutIOBuf> b) {
 
   kassert(b->Length() != 0);
-  // restore any queued buffers
-  if (buf_) {
-    buf_->PrependChain(std::move(b));
-  } else {
-    buf_ = std::move(b);
+  auto &core = *mcd_->cores_[size_t(Cpu::GetMine())];
+  auto &stats = core.stats;
+  stats.bytes_read += b->ComputeChainDataLength();
+  // every request framed from here on is timed from this point, and the
+  // core counted busy until the end
+  auto tracking = mcd_->track_latency_;
+  auto start = clock::Wall::Now();
+  size_t framed = 0;
+  framer_.Append(std::move(b));
+
+  // binary requests framed but not yet executed
+  std::unique_ptr<IOBuf> batch[kMaxBatch];
+  size_t batch_len = 0;
+  // requests executed whose latency is filed once their replies are sent.
+  // Should more arrive in one receive than there is room for, the earlier
+  // ones are filed right away and miss out on the send.
+  Sample done[kMaxBatch];
+  size_t ndone = 0;
+  auto reserve = [&](size_t n) {
+    if (ndone + n > kMaxBatch) {
+      mcd_->RecordLatency(done, ndone, start);
+      ndone = 0;
+    }
+  };
+  auto run_batch = [&]() {
+    if (!tracking) {
+      mcd_->ProcessBinaryBatch(batch, batch_len, reply_);
+    } else {
+      reserve(batch_len);
+      mcd_->ProcessBinaryBatch(batch, batch_len, reply_, done + ndone);
+      ndone += batch_len;
+    }
+    batch_len = 0;
+  };
+
+  bool ascii;
+  boost::string_ref line;
+  while (auto msg = framer_.Next(&ascii, &line)) {
+    framed++;
+    if (ascii) {
+      // replies go out in request order
+      run_batch();
+      Sample *sample = nullptr;
+      if (tracking) {
+        reserve(1);
+        sample = &done[ndone++];
+      }
+      auto reply = mcd_->ProcessAscii(std::move(msg), line, sample);
+      if (reply) {
+        reply_.Complete(std::move(reply));
+      }
+      continue;
+    }
+    batch[batch_len++] = std::move(msg);
+    if (batch_len == kMaxBatch) {
+      run_batch();
+    }
   }
 
-  // reply buffer pointer
-  std::unique_ptr<MutIOBuf> rbuf(nullptr);
+  run_batch();
+  auto rbuf = reply_.Finish(&stats.replies);
+  if (rbuf != nullptr) {
+    stats.bytes_written += rbuf->ComputeChainDataLength();
+    Send(std::move(rbuf));
+  }
+  if (tracking) {
+    mcd_->RecordLatency(done, ndone, start);
+  }
 
-  // process buffer chain
-  while (buf_) {
-    // inspeact buffer head
-    //auto bp = buf_->Data();
-    auto dp = buf_->GetDataPointer();
-    auto chain_len = buf_->ComputeChainDataLength();
+  auto &load = core.load;
+  load.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      clock::Wall::Now() - start)
+                      .count();
+  load.requests += framed;
+  if (tick_ != load.ticks) {
+    last_requests_ = tick_ + 1 == load.ticks ? tick_requests_ : 0;
+    tick_requests_ = 0;
+    tick_ = load.ticks;
+  }
+  tick_requests_ += framed;
+  if (unlikely(load.shed > 0)) {
+    Rebalance(core);
+  }
+}
 
-    // set protocol {binary, ascii} specifics
-    unsigned int head_len, body_len, message_len;
-    auto magic = dp.GetNoAdvance(1);
+/**
+ * LookupKey() - the key of a GET family request, if it sits in the first
+ * buffer of the request
+ */
+bool ebbrt::Memcached::LookupKey(IOBuf &req, KeyRef *key) {
+  auto len = req.Length();
+  if (len < sizeof(protocol_binary_request_header)) {
+    return false;
+  }
+  auto h = reinterpret_cast<const protocol_binary_request_header *>(req.Data());
+  switch (h->request.opcode) {
+  case PROTOCOL_BINARY_CMD_GET:
+  case PROTOCOL_BINARY_CMD_GETQ:
+  case PROTOCOL_BINARY_CMD_GETK:
+  case PROTOCOL_BINARY_CMD_GETKQ:
+    break;
+  default:
+    return false;
+  }
+  size_t keylen = ntohs(h->request.keylen);
+  auto offset = sizeof(protocol_binary_request_header) + h->request.extlen;
+  if (keylen > KeyRef::kMaxLength || offset + keylen > len) {
+    return false;
+  }
+  *key = KeyRef(boost::string_ref(
+      reinterpret_cast<const char *>(req.Data()) + offset, keylen));
+  return true;
+}
 
-    if (*magic == PROTOCOL_BINARY_REQ) {
-      head_len = sizeof(protocol_binary_request_header);
-      // Do we have enough data for a header?
-      if (chain_len < head_len) {
-        break; // preservinf partial packer in buf_
-      }
-      auto h = dp.Get<protocol_binary_request_header>();
-      body_len = htonl(h.request.bodylen);
-      message_len = head_len + body_len;
+uint8_t *ebbrt::Memcached::ReplyBuilder::Reserve(size_t len) {
+  if (!arena_ || arena_->Tailroom() < len) {
+    auto size = std::max(len, arena_size_);
+    auto arena = MakeUniqueIOBuf(size);
+    arena->TrimEnd(size);
+    arena_ = arena.get();
+    if (chain_) {
+      chain_->PrependChain(std::move(arena));
     } else {
-      kprintf("Unknown msg header. buf length:%u \n",(unsigned int)buf_->Length());
-      return;
+      chain_ = std::move(arena);
+    }
+    counts_.allocs++;
+    // a receive that outgrows its arena gets a bigger one next
+    if (arena_size_ < kMaxReplyArena) {
+      arena_size_ *= 2;
     }
+  }
+  auto dst = arena_->MutTail();
+  arena_->Append(len);
+  arena_bytes_ += len;
+  return dst;
+}
 
-    // start processing requests
-    std::unique_ptr<MutIOBuf> msg;
-
-    if (likely(chain_len == message_len)) {
-      // We have a full message
-      msg = std::move(buf_);
-    } else if (chain_len > message_len) {
-      // Handle the case when we've received multiple message in our buffer
-      // chain
-      //
-      // After this loop msg should hold exactly one message and everything
-      // else will be in buf_
-      bool first = true;
-      msg = std::move(buf_);
-      for (auto &buf : *msg) {
-        // for each buffer
-        auto buf_len = buf.Length();
-        if (buf_len == message_len) {
-          // If the first buffer contains the full message
-          // Move the remainder of chain into buf_, while our message remains
-          // in msg_
-          buf_ = std::unique_ptr<MutIOBuf>(
-              static_cast<MutIOBuf *>(msg->UnlinkEnd(*buf.Next()).release()));
-          break;
-        } else if (buf_len > message_len) {
-          // Here we need to split the buffer
-          std::unique_ptr<MutIOBuf> end;
-          if (first) {
-            end = std::move(msg);
-          } else {
-            auto tmp_end =
-                static_cast<MutIOBuf *>(msg->UnlinkEnd(buf).release());
-            end = std::unique_ptr<MutIOBuf>(tmp_end);
-          }
-          auto remainder = end->Pop();
-          // make a reference counted IOBuf to the end
-          auto rc_end = IOBuf::Create<MutSharedIOBufRef>(
-              SharedIOBufRef::CloneView, std::move(end));
-          // create a copy (increments ref count)
-          buf_ = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
-                                                  *rc_end);
-          // trim and append to msg
-          rc_end->TrimEnd(buf_len - message_len);
-          if (first) {
-            msg = std::move(rc_end);
-          } else {
-            msg->PrependChain(std::move(rc_end));
-          }
+protocol_binary_response_header *ebbrt::Memcached::ReplyBuilder::Header() {
+  auto dst = Reserve(sizeof(protocol_binary_response_header));
+  std::memset(dst, 0, sizeof(protocol_binary_response_header));
+  return reinterpret_cast<protocol_binary_response_header *>(dst);
+}
 
-          // advance to start of next message
-          buf_->Advance(message_len);
-          if (remainder)
-            buf_->PrependChain(std::move(remainder));
-          break;
-        }
-        message_len -= buf_len;
-        first = false;
-      } // end for(buf:msg)
-    } else {
-      // since message_len > chain_len we simply wait for more data
-      break;
-    }
+void ebbrt::Memcached::ReplyBuilder::Drop() {
+  kassert(arena_ &&
+          arena_->Length() >= sizeof(protocol_binary_response_header));
+  arena_->TrimEnd(sizeof(protocol_binary_response_header));
+  arena_bytes_ -= sizeof(protocol_binary_response_header);
+}
 
-    // msg now holds exactly one message
-    std::unique_ptr<IOBuf> replybuf(nullptr);
-    auto reply = MakeUniqueIOBuf(sizeof(protocol_binary_response_header), true);
-    // fixme: pass mutdatapointer instead of pointer
-    auto rehead =
-        reinterpret_cast<protocol_binary_response_header *>(reply->MutData());
-    replybuf = mcd_->ProcessBinary(std::move(msg), rehead);
-    // We send the response if response.magic is set,
-    if (rehead->response.magic == PROTOCOL_BINARY_RES) {
-      if (replybuf) {
-        reply->PrependChain(std::move(replybuf));
-      }
-      // queue data to send
-      if (rbuf == nullptr) {
-        rbuf = std::move(reply);
-      } else {
-        rbuf->PrependChain(std::move(reply));
-      }
+void ebbrt::Memcached::ReplyBuilder::Complete(std::unique_ptr<IOBuf> body) {
+  counts_.replies++;
+  if (!body) {
+    return;
+  }
+  auto len = body->ComputeChainDataLength();
+  if (len <= kInlineReply) {
+    auto dst = Reserve(len);
+    for (auto &buf : *body) {
+      std::memcpy(dst, buf.Data(), buf.Length());
+      dst += buf.Length();
     }
-  } // end while(buf_)
+    return;
+  }
+  counts_.allocs += body->CountChainElements();
+  if (chain_) {
+    chain_->PrependChain(std::move(body));
+  } else {
+    chain_ = std::move(body);
+  }
+  arena_ = nullptr;
+}
 
-  if (rbuf != nullptr) {
-    Send(std::move(rbuf));
+std::unique_ptr<ebbrt::IOBuf>
+ebbrt::Memcached::ReplyBuilder::Finish(ReplyCounts *counts) {
+  if (chain_) {
+    counts_.segments += chain_->CountChainElements();
   }
+  if (counts) {
+    counts->replies += counts_.replies;
+    counts->segments += counts_.segments;
+    counts->allocs += counts_.allocs;
+  }
+  counts_ = ReplyCounts();
+  // start the next receive with an arena as big as this one needed
+  arena_size_ = arena_bytes_ < kMinReplyArena
+                    ? kMinReplyArena
+                    : arena_bytes_ > kMaxReplyArena ? kMaxReplyArena
+                                                    : arena_bytes_;
+  arena_bytes_ = 0;
+  arena_ = nullptr;
+  return std::move(chain_);
+}
 
-  return;
+void ebbrt::Memcached::ProcessBinaryBatch(std::unique_ptr<IOBuf> *reqs,
+                                          size_t n,
+                                          ReplyBuilder &reply,
+                                          Sample *samples) {
+  KeyRef keys[kMaxBatch];
+  bool lookup[kMaxBatch];
+  kassert(n <= kMaxBatch);
+  // hash every key and start loading its bucket ...
+  for (size_t i = 0; i < n; i++) {
+    lookup[i] = LookupKey(*reqs[i], &keys[i]);
+    if (lookup[i]) {
+      ShardFor(keys[i].hash).table.prefetch(keys[i].hash);
+    }
+  }
+  // ... then the entry each bucket points to
+  for (size_t i = 0; i < n; i++) {
+    if (lookup[i]) {
+      ShardFor(keys[i].hash).table.prefetch_chain(keys[i].hash);
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    auto rhead = reply.Header();
+    auto body = ProcessBinary(std::move(reqs[i]), rhead,
+                              lookup[i] ? &keys[i] : nullptr,
+                              samples ? &samples[i] : nullptr);
+    // We send the response if response.magic is set
+    if (rhead->response.magic == PROTOCOL_BINARY_RES) {
+      reply.Complete(std::move(body));
+    } else {
+      reply.Drop();
+    }
+  }
 }
 
 std::unique_ptr<ebbrt::IOBuf>
 ebbrt::Memcached::ProcessBinary(std::unique_ptr<IOBuf> buf,
-                                protocol_binary_response_header *rhead) {
-  ebbrt::Memcached::GetResponse *res; // response buffer
+                                protocol_binary_response_header *rhead,
+                                const KeyRef *prepared, Sample *sample) {
+  ebbrt::Memcached::VersionedResponse *res; // response buffer
   std::unique_ptr<IOBuf> kv(nullptr); // key-value IObuf
-  std::string key;
+  char keybuf[KeyRef::kMaxLength];    // key spanning buffers is gathered here
   uint32_t bodylen = 0;
   uint16_t status = 0;
+  uint32_t exptime = 0;
 
   auto bdata = buf->GetDataPointer();
   // pull data from incoming header
   auto h = bdata.Get<protocol_binary_request_header>();
   int32_t keylen = ntohl(h.request.keylen << 16);
-  // pull key into string
-  bdata.Advance(h.request.extlen);
-  auto keyptr = bdata.Get(keylen);
-
-  if (keylen > 0) {
-    key = std::string(reinterpret_cast<const char *>(keyptr), keylen);
+  auto extras = bdata.Get(h.request.extlen);
+  Count(h.request.opcode);
+  Sample ignored;
+  if (sample == nullptr) {
+    sample = &ignored;
   }
+  sample->opcode = h.request.opcode;
+  sample->miss = false;
 
   // set response header defaults
   // we use magic as a signal to send or remaining quiet
   rhead->response.magic = 0;
   rhead->response.opcode = h.request.opcode;
+  rhead->response.extlen = 0;
+  rhead->response.opaque = h.request.opaque;
+  rhead->response.cas = 0;
+
+  if (unlikely(size_t(keylen) > KeyRef::kMaxLength ||
+               size_t(keylen) + h.request.extlen > ntohl(h.request.bodylen))) {
+    sample->miss = true;
+    rhead->response.magic = PROTOCOL_BINARY_RES;
+    rhead->response.keylen = 0;
+    rhead->response.status = (htonl(PROTOCOL_BINARY_RESPONSE_EINVAL) >> 16);
+    rhead->response.bodylen = 0;
+    return nullptr;
+  }
+  // reference the key in the request, no copy unless it spans buffers
+  auto key = prepared ? *prepared
+                      : ReadKey(*buf, sizeof(protocol_binary_request_header) +
+                                          h.request.extlen,
+                                keylen, keybuf);
+
+  // writes reply with their status and the new CAS, quiet ones only when
+  // they fail. Returns false if there is nothing to send.
+  auto quiet = IsQuiet(h.request.opcode);
+  auto write_reply = [&](Result ret, uint64_t cas) {
+    keylen = 0;
+    status = BinaryStatus(ret);
+    sample->miss = ret != Result::kOk;
+    if (ret == Result::kOk) {
+      if (quiet) {
+        return false;
+      }
+      rhead->response.cas = HostToNet64(cas);
+    }
+    rhead->response.magic = PROTOCOL_BINARY_RES;
+    return true;
+  };
+  auto value_offset =
+      sizeof(protocol_binary_request_header) + h.request.extlen + keylen;
+
   switch (h.request.opcode) {
   case PROTOCOL_BINARY_CMD_SET:
-    rhead->response.magic = PROTOCOL_BINARY_RES;
-  // no break
   case PROTOCOL_BINARY_CMD_SETQ:
-    Set(std::move((buf)), key);
-    return nullptr;
+  case PROTOCOL_BINARY_CMD_ADD:
+  case PROTOCOL_BINARY_CMD_ADDQ:
+  case PROTOCOL_BINARY_CMD_REPLACE:
+  case PROTOCOL_BINARY_CMD_REPLACEQ: {
+    uint32_t flags = 0;
+    if (h.request.extlen == 2 * sizeof(uint32_t)) {
+      // extras are <flags,expiration>, flags are stored as sent
+      std::memcpy(&flags, extras, sizeof(flags));
+      std::memcpy(&exptime, extras + sizeof(uint32_t), sizeof(exptime));
+      exptime = ntohl(exptime);
+    }
+    auto mode = StoreMode::kSet;
+    if (h.request.opcode == PROTOCOL_BINARY_CMD_ADD ||
+        h.request.opcode == PROTOCOL_BINARY_CMD_ADDQ) {
+      mode = StoreMode::kAdd;
+    } else if (h.request.opcode == PROTOCOL_BINARY_CMD_REPLACE ||
+               h.request.opcode == PROTOCOL_BINARY_CMD_REPLACEQ) {
+      mode = StoreMode::kReplace;
+    }
+    auto len = buf->ComputeChainDataLength() - value_offset;
+    auto cas = NetToHost64(h.request.cas);
+    auto ret = Set(Value{std::move(buf), value_offset, len, flags}, key,
+                   exptime, mode, &cas);
+    if (!write_reply(ret, cas)) {
+      return nullptr;
+    }
+    break;
+  }
+  case PROTOCOL_BINARY_CMD_APPEND:
+  case PROTOCOL_BINARY_CMD_APPENDQ:
+  case PROTOCOL_BINARY_CMD_PREPEND:
+  case PROTOCOL_BINARY_CMD_PREPENDQ: {
+    auto len = buf->ComputeChainDataLength() - value_offset;
+    auto cas = NetToHost64(h.request.cas);
+    auto append = h.request.opcode == PROTOCOL_BINARY_CMD_APPEND ||
+                  h.request.opcode == PROTOCOL_BINARY_CMD_APPENDQ;
+    auto ret =
+        Concat(Value{std::move(buf), value_offset, len, 0}, key, append, &cas);
+    if (!write_reply(ret, cas)) {
+      return nullptr;
+    }
+    break;
+  }
+  case PROTOCOL_BINARY_CMD_DELETE:
+  case PROTOCOL_BINARY_CMD_DELETEQ:
+    if (!write_reply(Delete(key, NetToHost64(h.request.cas)), 0)) {
+      return nullptr;
+    }
+    break;
+  case PROTOCOL_BINARY_CMD_INCREMENT:
+  case PROTOCOL_BINARY_CMD_INCREMENTQ:
+  case PROTOCOL_BINARY_CMD_DECREMENT:
+  case PROTOCOL_BINARY_CMD_DECREMENTQ: {
+    // extras are <delta,initial,expiration>
+    uint64_t delta, initial, result, cas = 0;
+    if (h.request.extlen != 2 * sizeof(uint64_t) + sizeof(uint32_t)) {
+      sample->miss = true;
+      rhead->response.magic = PROTOCOL_BINARY_RES;
+      keylen = 0;
+      status = PROTOCOL_BINARY_RESPONSE_EINVAL;
+      break;
+    }
+    std::memcpy(&delta, extras, sizeof(delta));
+    std::memcpy(&initial, extras + sizeof(uint64_t), sizeof(initial));
+    std::memcpy(&exptime, extras + 2 * sizeof(uint64_t), sizeof(exptime));
+    delta = NetToHost64(delta);
+    initial = NetToHost64(initial);
+    exptime = ntohl(exptime);
+    auto incr = h.request.opcode == PROTOCOL_BINARY_CMD_INCREMENT ||
+                h.request.opcode == PROTOCOL_BINARY_CMD_INCREMENTQ;
+    auto ret = Arith(key, incr, delta, &result, &cas);
+    // a miss creates the item at the initial value, unless the expiration
+    // is all ones
+    while (ret == Result::kNotFound && exptime != 0xffffffff) {
+      char digits[kMaxDigits + 1];
+      auto n = FormatU64(initial, digits);
+      cas = 0;
+      ret = Set(Value{IOBuf::Create<StaticIOBuf>(
+                          reinterpret_cast<const uint8_t *>(digits), n),
+                      0, n, 0},
+                key, exptime, StoreMode::kAdd, &cas);
+      if (ret == Result::kOk) {
+        result = initial;
+        break;
+      }
+      // created under us, count on that one
+      ret = Arith(key, incr, delta, &result, &cas);
+    }
+    if (!write_reply(ret, cas)) {
+      return nullptr;
+    }
+    if (ret == Result::kOk) {
+      // the body is the new value, nothing stored is referenced
+      auto body = MakeUniqueIOBuf(sizeof(result));
+      auto net = HostToNet64(result);
+      std::memcpy(body->MutData(), &net, sizeof(net));
+      bodylen = sizeof(net);
+      kv = std::move(body);
+    }
+    break;
+  }
   case PROTOCOL_BINARY_CMD_GET:
   case PROTOCOL_BINARY_CMD_GETQ:
   case PROTOCOL_BINARY_CMD_GETK:
   case PROTOCOL_BINARY_CMD_GETKQ:
     rhead->response.magic = PROTOCOL_BINARY_RES;
-    // binary() returns <ext, key, value>
+    // Clone() returns <ext, key, value>
     rhead->response.extlen = sizeof(uint32_t);
-    res = Get(std::move((buf)), key);
+    res = Get(key);
     if (res) {
       // Hit
-      // GetResponse::Binary() returns IOBuf containing <ext, key, value>
-      kv = res->Binary();
+      // VersionedResponse::Clone() returns IOBuf containing <ext, key, value>
+      uint64_t version;
+      kv = res->Clone(&version);
       bodylen += kv->ComputeChainDataLength();
+      rhead->response.cas = HostToNet64(version);
     } else {
       // Miss
+      sample->miss = true;
       if (h.request.opcode == PROTOCOL_BINARY_CMD_GETQ ||
           h.request.opcode == PROTOCOL_BINARY_CMD_GETKQ) {
         // If GETQ/GETKQ we send no response
@@ -331,7 +2818,7 @@ ebbrt::Memcached::ProcessBinary(std::unique_ptr<IOBuf> buf,
         // inthe case of GETK miss, we need to reply with key
         // auto keybuf = MakeUniqueIOBuf(keylen, true);
         // auto keybufptr = keybuf->GetMutDataPointer();
-        // std::memcpy(keybufptr.Data(), key.c_str(), keylen);
+        // std::memcpy(keybufptr.Data(), key.key.data(), keylen);
         // bodylen += keylen;
         // kv = std::move(keybuf);
       }
@@ -341,7 +2828,40 @@ ebbrt::Memcached::ProcessBinary(std::unique_ptr<IOBuf> buf,
       status = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
     }
     break;
+  case PROTOCOL_BINARY_CMD_STAT: {
+    rhead->response.magic = PROTOCOL_BINARY_RES;
+    StatList stats;
+    keylen = 0;
+    if (!Stats(key.key, &stats)) {
+      sample->miss = true;
+      status = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+      break;
+    }
+    if (stats.empty()) {
+      // this reply alone ends the list
+      break;
+    }
+    // One response per statistic with its name as the key, then an empty
+    // one. The first rides on this reply's header.
+    std::unique_ptr<MutIOBuf> out;
+    for (size_t i = 0; i < stats.size(); i++) {
+      auto &name = stats[i].first;
+      auto &val = stats[i].second;
+      if (i == 0) {
+        keylen = name.size();
+        bodylen = name.size() + val.size();
+      }
+      AppendReply(out, StatReply(h.request.opaque, name, val, i != 0));
+    }
+    AppendReply(out, StatReply(h.request.opaque, "", "", true));
+    kv = std::move(out);
+    break;
+  }
   case PROTOCOL_BINARY_CMD_NOOP:
+    // ends a quiet multi-get, the client waits for it
+    rhead->response.magic = PROTOCOL_BINARY_RES;
+    keylen = 0;
+    break;
   case PROTOCOL_BINARY_CMD_QUIT:
     Quit();
     break;
@@ -349,17 +2869,26 @@ ebbrt::Memcached::ProcessBinary(std::unique_ptr<IOBuf> buf,
     Quit();
     return nullptr;
   case PROTOCOL_BINARY_CMD_FLUSH:
+  case PROTOCOL_BINARY_CMD_FLUSHQ:
+    // optional extras are <expiration>, for a delayed flush
+    if (h.request.extlen == sizeof(uint32_t)) {
+      std::memcpy(&exptime, extras, sizeof(exptime));
+      exptime = ntohl(exptime);
+    }
+    Flush(exptime);
+    if (quiet) {
+      return nullptr;
+    }
     rhead->response.magic = PROTOCOL_BINARY_RES;
     keylen = 0;
     rhead->response.extlen = 0;
-    Flush();
     break;
-  case PROTOCOL_BINARY_CMD_FLUSHQ:
-    Flush();
-    return nullptr;
   default:
-    Unimplemented(h);
-    return nullptr;
+    sample->miss = true;
+    rhead->response.magic = PROTOCOL_BINARY_RES;
+    keylen = 0;
+    status = PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND;
+    break;
   }
 
   rhead->response.keylen = (htonl(keylen) >> 16);
@@ -367,3 +2896,158 @@ ebbrt::Memcached::ProcessBinary(std::unique_ptr<IOBuf> buf,
   rhead->response.bodylen = htonl(bodylen);
   return kv;
 }
+
+void ebbrt::Memcached::Framer::Append(std::unique_ptr<MutIOBuf> b) {
+  // restore any queued buffers
+  if (buf_) {
+    buf_->PrependChain(std::move(b));
+  } else {
+    buf_ = std::move(b);
+  }
+}
+
+std::unique_ptr<ebbrt::MutIOBuf>
+ebbrt::Memcached::Framer::Next(bool *ascii, boost::string_ref *line) {
+  if (!buf_) {
+    return nullptr;
+  }
+  auto dp = buf_->GetDataPointer();
+  auto chain_len = buf_->ComputeChainDataLength();
+
+  // set protocol {binary, ascii} specifics
+  size_t head_len, body_len, message_len;
+  auto magic = dp.GetNoAdvance(1);
+  *ascii = false;
+
+  if (*magic == PROTOCOL_BINARY_REQ) {
+    head_len = sizeof(protocol_binary_request_header);
+    // Do we have enough data for a header?
+    if (chain_len < head_len) {
+      return nullptr; // preserving partial packet in buf_
+    }
+    auto h = dp.Get<protocol_binary_request_header>();
+    body_len = htonl(h.request.bodylen);
+    message_len = head_len + body_len;
+  } else {
+    // text protocol: a command line, followed by a data block for
+    // storage commands
+    if (!FrameAscii(chain_len, &message_len, line)) {
+      return nullptr; // preserving partial request in buf_
+    }
+    *ascii = true;
+  }
+
+  if (likely(chain_len == message_len)) {
+    // We have a full message
+    return std::move(buf_);
+  }
+  if (chain_len < message_len) {
+    // wait for more data
+    return nullptr;
+  }
+  // Handle the case when we've received multiple message in our buffer
+  // chain
+  //
+  // After this loop msg should hold exactly one message and everything
+  // else will be in buf_
+  bool first = true;
+  auto msg = std::move(buf_);
+  for (auto &buf : *msg) {
+    // for each buffer
+    auto buf_len = buf.Length();
+    if (buf_len == message_len) {
+      // If the first buffer contains the full message
+      // Move the remainder of chain into buf_, while our message remains
+      // in msg_
+      buf_ = std::unique_ptr<MutIOBuf>(
+          static_cast<MutIOBuf *>(msg->UnlinkEnd(*buf.Next()).release()));
+      break;
+    } else if (buf_len > message_len) {
+      // Here we need to split the buffer
+      std::unique_ptr<MutIOBuf> end;
+      if (first) {
+        end = std::move(msg);
+      } else {
+        auto tmp_end = static_cast<MutIOBuf *>(msg->UnlinkEnd(buf).release());
+        end = std::unique_ptr<MutIOBuf>(tmp_end);
+      }
+      auto remainder = end->Pop();
+      // make a reference counted IOBuf to the end
+      auto rc_end = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
+                                                     std::move(end));
+      // create a copy (increments ref count)
+      buf_ = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
+                                              *rc_end);
+      // trim and append to msg
+      rc_end->TrimEnd(buf_len - message_len);
+      if (first) {
+        msg = std::move(rc_end);
+      } else {
+        msg->PrependChain(std::move(rc_end));
+      }
+
+      // advance to start of next message
+      buf_->Advance(message_len);
+      if (remainder)
+        buf_->PrependChain(std::move(remainder));
+      break;
+    }
+    message_len -= buf_len;
+    first = false;
+  }
+  // msg now holds exactly one message
+  return msg;
+}
+
+/**
+ * FrameAscii() - find the extent of the text request at the head of buf_.
+ * Returns false if it has not fully arrived. line is left pointing at the
+ * command line without its terminator, in place when it sits in the first
+ * buffer and gathered into line_ otherwise.
+ */
+bool ebbrt::Memcached::Framer::FrameAscii(size_t chain_len,
+                                          size_t *message_len,
+                                          boost::string_ref *line) {
+  size_t line_len = 0;
+  bool found = false;
+  for (auto &buf : *buf_) {
+    auto data = buf.Data();
+    auto nl = static_cast<const uint8_t *>(
+        std::memchr(data, '\n', buf.Length()));
+    if (nl) {
+      line_len += nl - data + 1;
+      found = true;
+      break;
+    }
+    line_len += buf.Length();
+  }
+  if (!found) {
+    if (unlikely(chain_len > kMaxAsciiLine)) {
+      // not a request we will ever parse, drop it and report an error
+      *message_len = chain_len;
+      *line = boost::string_ref();
+      return true;
+    }
+    return false;
+  }
+  const char *start;
+  if (likely(line_len <= buf_->Length())) {
+    start = reinterpret_cast<const char *>(buf_->Data());
+  } else {
+    line_.resize(line_len);
+    CopyChain(*buf_, 0, reinterpret_cast<uint8_t *>(&line_[0]), line_len);
+    start = line_.data();
+  }
+  auto len = line_len - 1;
+  if (len > 0 && start[len - 1] == '\r') {
+    len--;
+  }
+  *line = boost::string_ref(start, len);
+  *message_len = line_len;
+  size_t bytes;
+  if (AsciiDataLength(*line, &bytes)) {
+    // the data block and its terminator
+    *message_len += bytes + 2;
+  }
+  return chain_len >= *message_len;
+}
@@ -5,91 +5,777 @@
 #ifndef MEMCACHED_H
 #define MEMCACHED_H
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/intrusive/list.hpp>
+#include <boost/utility/string_ref.hpp>
 
-#include <ebbrt/AtomicUniquePtr.h>
 #include <ebbrt/CacheAligned.h>
 #include <ebbrt/SharedIOBufRef.h>
 #include <ebbrt/SpinLock.h>
 #include <ebbrt/StaticSharedEbb.h>
+#include <ebbrt/native/Clock.h>
+#include <ebbrt/native/Cpu.h>
 #include <ebbrt/native/Net.h>
 #include <ebbrt/native/NetTcpHandler.h>
-#include <ebbrt/native/RcuTable.h>
+#include <ebbrt/native/Timer.h>
 
+#include "CountMinSketch.h"
+#include "KeyRef.h"
+#include "LatencyHistogram.h"
+#include "RcuResizableHashTable.h"
+#include "SlabAllocator.h"
+#include "TimerWheel.h"
 #include "protocol_binary.h"
 
 namespace ebbrt {
 class Memcached : public StaticSharedEbb<Memcached>, public CacheAligned {
 public:
+  /** Usage - store occupancy and event counts aggregated over all cores
+   */
+  struct Usage {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t sets;
+    uint64_t set_bytes;
+    uint64_t total_connections;
+    uint64_t curr_connections;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t replies;
+    uint64_t reply_segments;
+    uint64_t reply_allocs;
+    // datagrams received and sent, and received ones not answered
+    uint64_t udp_received;
+    uint64_t udp_sent;
+    uint64_t udp_dropped;
+    // requests of either protocol, by binary opcode
+    uint64_t cmds[PROTOCOL_BINARY_CMD_PREPENDQ + 1];
+    size_t items;
+    size_t resident_bytes;
+    // what values actually keep allocated, see VersionedResponse::Held()
+    size_t held_bytes;
+    size_t limit_bytes;
+    // keys replicated, summed over cores, and the GETs their replicas served
+    size_t hot_keys;
+    uint64_t replica_hits;
+    uint64_t replica_copies;
+    size_t buckets;
+    double load_factor;
+  };
+
   Memcached();
   void Start(uint16_t port);
+  /** SetMemoryLimit() - cap on resident bytes across all cores. A core
+   * that finds the store over it evicts from its own CLOCK list, or has
+   * another core evict if its list is empty.
+   */
+  void SetMemoryLimit(size_t bytes);
+  /** SetReportInterval() - periodically print Usage from the core that
+   * calls Start(). Zero (the default) disables reporting.
+   */
+  void SetReportInterval(std::chrono::seconds interval);
+  /** SetShards() - split the key space into n lock stripes (rounded up to
+   * a power of two), each with its own table, so inserts of keys in
+   * different shards never contend. Must be called before the store is
+   * used; the default is a single shard.
+   */
+  void SetShards(size_t n);
+  Usage GetUsage() const;
+  void ReportUsage() const;
+  SlabAllocator::Stats GetSlabStats() const { return slab_.GetStats(); }
+  /** SetSlabBypass() - allocate entries and values from the general heap
+   */
+  void SetSlabBypass(bool bypass) { slab_.SetBypass(bypass); }
+
+  /** Placement - how new connections are spread over the cores */
+  enum class Placement {
+    // in turn, whatever the load
+    kRoundRobin,
+    // to the core with the lowest recent utilization, near ties going to
+    // the one with fewer connections
+    kLeastLoaded
+  };
+  /** SetPlacement() - policy for new connections, kLeastLoaded by default
+   */
+  void SetPlacement(Placement p) { placement_ = p; }
+  /** SetRebalancing() - once a second, a core running well above the
+   * average utilization hands one of its busier connections to the least
+   * loaded core. The move happens at the end of a receive, with every
+   * request it framed answered. Off by default.
+   */
+  void SetRebalancing(bool on) { rebalance_ = on; }
+  /** SetUdpPort() - also serve binary GET, GETQ, GETK and GETKQ (and NOOP)
+   * over UDP on port once Start() is called, in memcached's UDP framing.
+   * Each datagram is answered on the core it arrived on, replies split
+   * into datagrams of at most kUdpPayload bytes. Zero, the default, keeps
+   * to TCP.
+   */
+  void SetUdpPort(uint16_t port) { udp_port_ = port; }
+
+  /** WriteSnapshot() - serialize every live item for LoadSnapshot() in the
+   * background: each event walks kSnapshotBatch buckets and hands their
+   * records to sink, in order, so GETs and writes carry on meanwhile.
+   * done gets the number of items written after the last chunk. Items
+   * written during the walk may or may not make it in.
+   */
+  void WriteSnapshot(std::function<void(std::unique_ptr<IOBuf>)> sink,
+                     std::function<void(size_t items)> done);
+  /** LoadSnapshot() - store the items of a snapshot held in memory, e.g. a
+   * mapped file. Each record is the stored <flags,key,value> as is, which
+   * is copied straight into a new entry. Keys already live and items
+   * expired since are skipped. Returns false if data is not a snapshot or
+   * is cut short; items sets the number stored either way.
+   */
+  bool LoadSnapshot(const void *data, size_t len, size_t *items);
+  /** Preload() - store the items of a dataset (see DatasetBlock) held in
+   * memory, e.g. a mapped file, bypassing the network and the protocol.
+   * The blocks are split into one run per core and each core stores its
+   * run as its own items, keeping any key already live. done is called on
+   * the calling core with the number stored once every core is through,
+   * and ok false if the data is malformed; blocks before the bad one are
+   * still stored.
+   */
+  void Preload(const void *data, size_t len,
+               std::function<void(size_t items, bool ok)> done);
+
+  /** Sample - what a request's latency is filed under: the binary opcode
+   * it counts as (text commands take their binary equivalent) and whether
+   * it missed, i.e. found no item or failed
+   */
+  struct Sample {
+    // requests that map to no opcode are not filed
+    uint8_t opcode{0xff};
+    bool miss{false};
+  };
+
+  /** ProcessAscii() - execute one text protocol request. line is the
+   * command line without its terminator and may point into the message,
+   * which for storage commands carries the data block after the line.
+   * Returns the reply, or nullptr if there is none (noreply).
+   */
+  std::unique_ptr<MutIOBuf> ProcessAscii(std::unique_ptr<IOBuf>,
+                                         boost::string_ref line,
+                                         Sample *sample = nullptr);
+  std::unique_ptr<IOBuf> ProcessBinary(std::unique_ptr<IOBuf>,
+                                       protocol_binary_response_header *,
+                                       const KeyRef *key = nullptr,
+                                       Sample *sample = nullptr);
+  /** ReplyCounts - replies built, the buffers they went out in and the
+   * buffers allocated for them, arenas and bodies chained by reference
+   */
+  struct ReplyCounts {
+    uint64_t replies{0};
+    uint64_t segments{0};
+    uint64_t allocs{0};
+  };
+
+  /**
+   * ReplyBuilder - packs the replies of one receive into as few buffers as
+   * it can. Headers, and bodies of up to kInlineReply bytes, are copied
+   * into an arena buffer; larger bodies are chained by reference and the
+   * next reply opens a new arena behind them. Each session keeps one and
+   * sizes its first arena by what the previous receive used.
+   */
+  class ReplyBuilder {
+  public:
+    /** Header() - a zeroed binary response header at the end of the
+     * reply, valid until the next call. Drop() takes it back.
+     */
+    protocol_binary_response_header *Header();
+    void Drop();
+    /** Complete() - end a reply with body, which may be null, behind its
+     * header if it has one
+     */
+    void Complete(std::unique_ptr<IOBuf> body);
+    /** Finish() - the chain of every reply completed, or nullptr if there
+     * were none. Adds what it took to counts, if given.
+     */
+    std::unique_ptr<IOBuf> Finish(ReplyCounts *counts = nullptr);
+
+  private:
+    uint8_t *Reserve(size_t len);
+    std::unique_ptr<IOBuf> chain_;
+    // where headers and small bodies are copied, null after a reference
+    MutIOBuf *arena_{nullptr};
+    size_t arena_size_{kMinReplyArena};
+    size_t arena_bytes_{0};
+    ReplyCounts counts_;
+  };
+
+  /** ProcessBinaryBatch() - execute n framed binary requests in order and
+   * append their replies to reply. The keys of GET family requests are
+   * hashed and their buckets and chains prefetched before the first one is
+   * resolved, so the cache misses of a multi-get burst overlap. If samples
+   * is given it receives one Sample per request.
+   */
+  void ProcessBinaryBatch(std::unique_ptr<IOBuf> *reqs, size_t n,
+                          ReplyBuilder &reply,
+                          Sample *samples = nullptr);
+  /**
+   * Framer - splits one connection's byte stream into whole requests of
+   * either protocol. Received buffers are appended; Next() detaches the
+   * request at the head, splitting a shared buffer where one request ends
+   * and the next begins, and keeps a partial request for later appends.
+   */
+  class Framer {
+  public:
+    void Append(std::unique_ptr<MutIOBuf> b);
+    /** Next() - the next whole request, or nullptr if none is buffered.
+     * For a text request ascii is set and line is its command line, which
+     * stays valid until the following call.
+     */
+    std::unique_ptr<MutIOBuf> Next(bool *ascii, boost::string_ref *line);
+
+  private:
+    bool FrameAscii(size_t chain_len, size_t *message_len,
+                    boost::string_ref *line);
+    std::unique_ptr<MutIOBuf> buf_;
+    // a command line split across receive buffers is gathered here
+    std::string line_;
+  };
+
+  /** SetLatencyTracking() - time every request from the receive that framed
+   * it to the send of its reply into per-core histograms by opcode and
+   * hit or miss, reported by the "latency" STAT group. On by default.
+   */
+  void SetLatencyTracking(bool on) { track_latency_ = on; }
+  /** SetHotKeyReplicas() - give keys a core reads often a private copy on
+   * that core, so their GETs stop sharing buffers with every other core.
+   * The "hotkeys" STAT group lists them. On by default.
+   */
+  void SetHotKeyReplicas(bool on) { replicate_ = on; }
+
+  static const constexpr size_t kDefaultMemoryLimit = 64 << 20; // 64MB
+  // the store starts at, and never shrinks below, 8k buckets in total
+  static const constexpr size_t kTableBits = 13;
+  // expiration values up to 30 days are relative, larger ones are absolute
+  static const constexpr uint32_t kRelativeExpiryMax = 60 * 60 * 24 * 30;
+  // longest text protocol command line accepted
+  static const constexpr size_t kMaxAsciiLine = 64 * 1024;
+  // binary requests framed from one receive burst before executing them
+  static const constexpr size_t kMaxBatch = 128;
+  // stored values are copied out of request buffers pinning more than this
+  // many times their size
+  static const constexpr size_t kCompactRatio = 2;
+  // reply bodies up to this many bytes are copied rather than referenced
+  static const constexpr size_t kInlineReply = 1024;
+  // bounds of a reply arena, which doubles while one receive fills it
+  static const constexpr size_t kMinReplyArena = 1024;
+  static const constexpr size_t kMaxReplyArena = 64 * 1024;
+  // a key is hot once the sketch estimates kHotThreshold of one in every
+  // kHotSample hits on a core, which halves every tick: about 500 GETs/s
+  static const constexpr size_t kHotSample = 16;
+  static const constexpr uint32_t kHotThreshold = 64;
+  // replica slots per core, and the largest version copied into one
+  static const constexpr size_t kReplicas = 64;
+  static const constexpr size_t kMaxReplica = 4096;
+  // largest reply datagram, frame header included, as memcached sends
+  static const constexpr size_t kUdpPayload = 1400;
 
 private:
+  /**
+   * Value - a value as it arrived in a request of either protocol: its
+   * bytes are [offset, offset + len) of buf.
+   */
+  struct Value {
+    std::unique_ptr<IOBuf> buf;
+    size_t offset;
+    size_t len;
+    // client flags in network byte order
+    uint32_t flags;
+  };
+
+  /**
+   * SnapshotHeader, SnapshotRecord - the snapshot format, in host byte
+   * order. The header is followed by records, each 8 byte aligned with the
+   * stored <flags,key,value> of an item right behind it.
+   */
+  struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+  };
+  struct SnapshotRecord {
+    // bytes of <flags,key,value>
+    uint32_t len;
+    // absolute, zero if the item never expires
+    uint32_t expires;
+    uint16_t key_len;
+    uint16_t reserved[3];
+  };
+  /** SnapshotWalk - where a WriteSnapshot() has got to */
+  struct SnapshotWalk {
+    std::function<void(std::unique_ptr<IOBuf>)> sink;
+    std::function<void(size_t)> done;
+    size_t shard{0};
+    size_t bucket{0};
+    // bucket count of the shard's table when bucket was taken
+    size_t buckets{0};
+    size_t items{0};
+  };
+
+  /**
+   * UdpFrame - leads every datagram of memcached's UDP transport, in
+   * network byte order. A reply carries the request's id and numbers its
+   * datagrams 0 to datagrams - 1.
+   */
+  struct UdpFrame {
+    uint16_t request_id;
+    uint16_t sequence;
+    uint16_t datagrams;
+    uint16_t reserved;
+  };
+
+  enum class StoreMode { kSet, kAdd, kReplace };
+  /** StatList - name and value of each statistic in a STAT group */
+  typedef std::vector<std::pair<std::string, std::string>> StatList;
+  /** Result - outcome of a store operation, named after the text protocol
+   * replies
+   */
+  enum class Result { kOk, kNotStored, kExists, kNotFound, kNonNumeric };
+
+  /**
+   * VersionedResponse - one version of an item's <flags,key,value> and its
+   * CAS. Every write but a counter update installs a new one, so the
+   * version an item carries can be checked and replaced with a single
+   * compare-exchange of the pointer.
+   * Every buffer of the chain is a MutSharedIOBufRef, so clones and later
+   * versions (APPEND/PREPEND) can hold their own reference on each.
+   */
+  class VersionedResponse : public MutSharedIOBufRef {
+  public:
+    template <typename... Args>
+    explicit VersionedResponse(uint64_t cas, Args &&... args)
+        : MutSharedIOBufRef(std::forward<Args>(args)...), cas(cas) {}
+    /** VersionedResponse::Clone() - a view of the stored chain to send and
+     * the CAS it was taken at. A counter gets its digits rendered from the
+     * value it holds at that moment.
+     */
+    std::unique_ptr<MutSharedIOBufRef> Clone(uint64_t *version);
+    /** VersionedResponse::Cas() - the CAS clients see while a counter's
+     * number is n: the version's CAS and the update sequence in n, with the
+     * top bit set so it never equals a plain version's CAS. It changes on
+     * every update without taking a new version, even one that restores an
+     * earlier value.
+     */
+    uint64_t Cas(uint64_t n) const;
+    /** VersionedResponse::Held() - capacity of every buffer the chain
+     * references, against the bytes it stores. A buffer shared with other
+     * versions is counted by each.
+     */
+    size_t Held() const;
+    const uint64_t cas;
+    // Counters store only <flags,key> and keep their value natively in
+    // number, so INCR/DECR update them in place. number packs the value in
+    // its low kValueBits and an update sequence above it, both changed by
+    // the same compare-exchange. A write that takes the version's place
+    // first sets kSealed, after which number never changes.
+    bool counter{false};
+    std::atomic<uint64_t> number{0};
+    static const constexpr uint64_t kSealed = uint64_t(1) << 63;
+    static const constexpr size_t kValueBits = 48;
+    static const constexpr uint64_t kMaxValue =
+        (uint64_t(1) << kValueBits) - 1;
+    // updates in place before the counter takes a new version
+    static const constexpr uint64_t kMaxSequence =
+        (kSealed >> kValueBits) - 1;
+  };
+
   /**
    * GetResponse - response strings are stored as the value of hash table
    * allowing minimal packet construction on a GET response.
    *
    * GetReponse binary format: <ext,key,value> e.g, <0001123>
+   *
+   * Versions replaced or taken out are only freed after an RCU grace period
+   * so the pointer a reader loaded stays valid for the rest of its event.
    */
   class GetResponse {
   public:
     GetResponse();
-    /** GetResponse() - store only request string on default path
+    ~GetResponse();
+    /** GetResponse::Current() - the installed version, nullptr once the
+     * entry has been unlinked
+     */
+    VersionedResponse *Current() const {
+      return binary_response_.load(std::memory_order_acquire);
+    }
+    /** GetResponse::CreateBinaryResponse() - values that fit a slab class
+     * are copied out so the receive buffer can be released, larger values
+     * keep referencing the request chain with <flags,key> written in place
+     * just ahead of the value, unless the buffers they would pin are more
+     * than kCompactRatio times their size; those are copied out as well.
+     * The stored extras are the client flags; the expiration lives on the
+     * TableEntry.
      */
-    GetResponse(std::unique_ptr<IOBuf>);
-    /** GetResponse::Binary() - return binary formatted response string.
-     * Format the string from original request if it does not exist.
+    static std::unique_ptr<VersionedResponse>
+    CreateBinaryResponse(Value, boost::string_ref key, SlabAllocator &,
+                         uint64_t cas);
+    std::unique_ptr<VersionedResponse>
+    Swap(std::unique_ptr<VersionedResponse> b);
+    /** GetResponse::CompareExchange() - install b if expected is still
+     * current, handing the replaced version back in b. On failure expected
+     * is updated to the current version and b is left alone.
      */
-    std::unique_ptr<IOBuf> Binary();
-    static std::unique_ptr<MutSharedIOBufRef>
-    CreateBinaryResponse(std::unique_ptr<IOBuf> b);
-    std::unique_ptr<MutSharedIOBufRef>
-    Swap(std::unique_ptr<MutSharedIOBufRef> b);
+    bool CompareExchange(VersionedResponse *&expected,
+                         std::unique_ptr<VersionedResponse> &b);
+    /** GetResponse::Size() - bytes of <ext,key,value> currently stored
+     */
+    size_t Size() const;
+    /** GetResponse::Held() - VersionedResponse::Held() of the current
+     * version
+     */
+    size_t Held() const;
 
   private:
-    ebbrt::atomic_unique_ptr<MutSharedIOBufRef> binary_response_{nullptr};
+    std::atomic<VersionedResponse *> binary_response_{nullptr};
   };
 
+  typedef boost::intrusive::list_member_hook<
+      boost::intrusive::link_mode<boost::intrusive::auto_unlink>>
+      WheelHook;
+
+  class Shard;
+
+  /**
+   * TableEntry - allocated from the slab together with its key, which is
+   * stored inline right after the entry.
+   */
   class TableEntry {
   public:
-    TableEntry(std::string key, std::unique_ptr<IOBuf> val)
-        : key(std::move(key)), value(std::move(val)) {}
+    static TableEntry *Create(SlabAllocator &slab, Shard &shard,
+                              boost::string_ref key,
+                              std::unique_ptr<VersionedResponse> val,
+                              size_t owner, uint32_t expires,
+                              uint32_t generation);
+    static void Destroy(TableEntry *entry);
+    /** Footprint() - bytes charged to the owning core and the memory limit
+     */
+    size_t Footprint() const {
+      return SlabAllocator::ClassSize(sizeof(TableEntry) + key.size()) +
+             value.Size();
+    }
+    /** Held() - the same for what the entry keeps allocated
+     */
+    size_t Held() const {
+      return SlabAllocator::ClassSize(sizeof(TableEntry) + key.size()) +
+             value.Held();
+    }
     /** Rcu data */
-    ebbrt::RcuHListHook hook;
-    std::string key;
+    RcuResizableHook<TableEntry> hook;
+    boost::string_ref key;
     GetResponse value;
+    Shard *shard;
+    /** CLOCK data, guarded by the owning core's lock */
+    boost::intrusive::list_member_hook<> clock_hook;
+    std::atomic<bool> referenced{false};
+    size_t owner;
+    /** Absolute expiry in seconds, zero if the entry never expires */
+    std::atomic<uint32_t> expires;
+    /** Timer wheel data, guarded by the owning core's lock */
+    WheelHook wheel_hook;
+    uint32_t wheel_deadline{0};
+    /** Flush generation the entry was stored in, see Flush() */
+    const uint32_t generation;
+
+  private:
+    TableEntry(boost::string_ref key, std::unique_ptr<VersionedResponse> val,
+               Shard &shard, size_t owner, uint32_t expires,
+               uint32_t generation)
+        : key(key), shard(&shard), owner(owner), expires(expires),
+          generation(generation) {
+      value.Swap(std::move(val));
+    }
+  };
+
+  typedef boost::intrusive::list<
+      TableEntry,
+      boost::intrusive::member_hook<TableEntry,
+                                    boost::intrusive::list_member_hook<>,
+                                    &TableEntry::clock_hook>>
+      ClockList;
+
+  typedef TimerWheel<TableEntry, WheelHook, &TableEntry::wheel_hook,
+                     &TableEntry::wheel_deadline>
+      ExpiryWheel;
+
+  typedef RcuResizableHashTable<TableEntry, boost::string_ref,
+                                &TableEntry::hook, &TableEntry::key,
+                                KeyRef::Hash>
+      Table;
+
+  /**
+   * Shard - one lock stripe of the key space with its own table. Writers
+   * to different shards never contend and lookups take no lock at all.
+   * Lock order is shard before CoreStore.
+   */
+  class Shard : public CacheAligned {
+  public:
+    explicit Shard(size_t bits) : table(bits, bits) {}
+    ebbrt::SpinLock lock;
+    Table table;
+    std::atomic<bool> resize_scheduled{false};
+  };
+
+  class Reaper : public Timer::Hook {
+  public:
+    explicit Reaper(Memcached *mcd) : mcd_(mcd) {}
+    void Fire() override { mcd_->Expire(); }
+
+  private:
+    Memcached *mcd_;
+  };
+
+  /**
+   * CoreStats - event counters of one core. Only that core writes them, with
+   * plain increments; STAT sums them over all cores and tolerates values a
+   * little stale. Kept on their own lines, away from the CoreStore fields
+   * other cores write.
+   */
+  class CoreStats : public CacheAligned {
+  public:
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+    // stores that succeeded and the value bytes they carried
+    uint64_t sets{0};
+    uint64_t set_bytes{0};
+    // opened on the accepting core, closed on the connection's core
+    uint64_t conns_opened{0};
+    uint64_t conns_closed{0};
+    uint64_t bytes_read{0};
+    uint64_t bytes_written{0};
+    ReplyCounts replies;
+    uint64_t udp_received{0};
+    uint64_t udp_sent{0};
+    uint64_t udp_dropped{0};
+    // GET hits served from a replica, and replicas made or refreshed
+    uint64_t replica_hits{0};
+    uint64_t replica_copies{0};
+    uint64_t cmds[PROTOCOL_BINARY_CMD_PREPENDQ + 1] = {};
+    // by [miss][opcode], allocated on first use
+    std::unique_ptr<LatencyHistogram> latency[2]
+                                             [PROTOCOL_BINARY_CMD_PREPENDQ + 1];
+  };
+
+  /**
+   * CoreLoad - what connection placement weighs a core by. The owner adds
+   * up the time it spends in Receive() and turns it into utilization on
+   * its reaper tick; other cores read that and count the connections they
+   * hand it.
+   */
+  class CoreLoad : public CacheAligned {
+  public:
+    std::atomic<size_t> sessions{0};
+    // share of time in Receive() over the last ticks, per mille, smoothed
+    std::atomic<uint32_t> utilization{0};
+    /** owner only from here */
+    uint64_t busy_ns{0};
+    uint64_t requests{0};
+    // busy_ns and requests at the last tick, and when it was
+    uint64_t tick_busy_ns{0};
+    uint64_t tick_requests{0};
+    clock::Wall::time_point tick_time;
+    uint64_t ticks{0};
+    // requests in the last whole tick, and per second
+    uint64_t window_requests{0};
+    uint64_t request_rate{0};
+    // connections to hand off before the next tick
+    size_t shed{0};
+    uint64_t migrated_out{0};
+  };
+
+  /**
+   * Replica - a core's private copy of a hot item's current version. GETs
+   * on that core clone the copy rather than the buffers every core shares,
+   * once they have checked the entry still carries the version copied, so
+   * a write just leaves the copy stale and the next GET refreshes it.
+   */
+  struct Replica {
+    TableEntry *entry{nullptr};
+    uint64_t cas{0};
+    std::unique_ptr<VersionedResponse> copy;
+    size_t key_len{0};
+    // GETs served, and how many as of the last tick
+    uint64_t hits{0};
+    uint64_t tick_hits{0};
+  };
+
+  /**
+   * CoreStore - per-core eviction and expiry state. Entries are owned by the
+   * core that inserted them and sit on that core's CLOCK list, and on its
+   * timer wheel if they carry an expiration, until removed.
+   */
+  class CoreStore : public CacheAligned {
+  public:
+    CoreStore(Memcached *mcd, uint32_t now)
+        : now(now), wheel(now), reaper(mcd) {}
+    ebbrt::SpinLock lock;
+    ClockList clock;
+    // seconds, refreshed by the reaper tick on this core
+    uint32_t now;
+    ExpiryWheel wheel;
+    // came due on the wheel, waiting for the reaper
+    ExpiryWheel::List due;
+    Reaper reaper;
+    // live generation floor this core's entries were last swept for
+    uint32_t swept{1};
+    size_t items{0};
+    // charged on insert/overwrite, released once an entry is freed
+    std::atomic<size_t> resident_bytes{0};
+    // the same for bytes held, see TableEntry::Held()
+    std::atomic<size_t> held_bytes{0};
+    // a Reclaim() has been sent here and not yet run
+    std::atomic<bool> nudged{false};
+    // CAS versions handed out by this core
+    uint64_t cas_seq{0};
+    // every kHotSample-th GET hit is counted in the sketch
+    CountMinSketch sketch;
+    size_t hot_countdown{kHotSample};
+    Replica replicas[kReplicas];
+    // replicated keys and their hits over the last tick, guarded by lock
+    std::vector<std::pair<std::string, uint64_t>> hot;
+    // replies to the datagrams this core receives
+    ReplyBuilder udp_reply;
+    CoreStats stats;
+    CoreLoad load;
+  };
+
+  class Reporter : public Timer::Hook {
+  public:
+    explicit Reporter(Memcached *mcd) : mcd_(mcd) {}
+    void Fire() override { mcd_->ReportUsage(); }
+
+  private:
+    Memcached *mcd_;
   };
 
   class TcpSession : public ebbrt::TcpHandler {
   public:
     TcpSession(Memcached *mcd, ebbrt::NetworkManager::TcpPcb pcb)
         : ebbrt::TcpHandler(std::move(pcb)), mcd_(mcd) {}
-    void Close() {}
-    void Abort() {}
+    void Close();
+    void Abort();
     void Receive(std::unique_ptr<MutIOBuf> b);
 
   private:
-    std::unique_ptr<ebbrt::MutIOBuf> buf_;
+    void Rebalance(CoreStore &core);
+    Framer framer_;
+    ReplyBuilder reply_;
+    // requests received since the owner's tick numbered tick_, and in the
+    // tick before
+    uint64_t tick_{0};
+    uint64_t tick_requests_{0};
+    uint64_t last_requests_{0};
     ebbrt::NetworkManager::TcpPcb pcb_;
     Memcached *mcd_;
   };
 
-  std::unique_ptr<IOBuf> ProcessAscii(std::unique_ptr<IOBuf>, std::string);
-  std::unique_ptr<IOBuf> ProcessBinary(std::unique_ptr<IOBuf>,
-                                       protocol_binary_response_header *);
   static const char *com2str(uint8_t);
-  GetResponse *Get(std::unique_ptr<IOBuf>, std::string);
-  void Set(std::unique_ptr<IOBuf>, std::string);
+  static uint16_t BinaryStatus(Result);
+  static uint32_t CurrentTime();
+  static uint32_t ExpiryTime(uint32_t exptime, uint32_t now);
+  static KeyRef ReadKey(IOBuf &, size_t offset, size_t len, char *scratch);
+  static bool LookupKey(IOBuf &, KeyRef *);
+  static bool UdpServed(uint8_t opcode);
+  bool Live(const TableEntry &, uint32_t now) const;
+  VersionedResponse *Get(const KeyRef &);
+  VersionedResponse *Replicated(CoreStore &, TableEntry &, VersionedResponse *,
+                                size_t hash);
+  void UpdateHotKeys(CoreStore &);
+  uint64_t NextCas();
+  Result Set(Value, const KeyRef &, uint32_t exptime,
+             StoreMode mode = StoreMode::kSet, uint64_t *cas = nullptr);
+  Result Replace(TableEntry &, std::unique_ptr<VersionedResponse> &,
+                 uint64_t expected, uint32_t expires);
+  bool Restore(const KeyRef &, std::unique_ptr<VersionedResponse>,
+               uint32_t expires);
+  void SnapshotBatch(std::unique_ptr<SnapshotWalk>);
+  bool PreloadBlock(const uint8_t *block, size_t *items);
+  void Release(size_t owner, std::unique_ptr<VersionedResponse>);
+  Result Concat(Value, const KeyRef &, bool append, uint64_t *cas = nullptr);
+  Result Delete(const KeyRef &, uint64_t cas = 0);
+  Result Arith(const KeyRef &, bool incr, uint64_t delta, uint64_t *result,
+               uint64_t *cas = nullptr);
+  std::unique_ptr<MutIOBuf> AsciiGet(boost::string_ref keys, bool cas,
+                                     bool *miss);
+  std::unique_ptr<MutIOBuf> AsciiStats(boost::string_ref group);
+  bool Stats(boost::string_ref group, StatList *);
+  void Count(uint8_t opcode);
+  void RecordLatency(const Sample *, size_t n, clock::Wall::time_point start);
+  void ReceiveUdp(Ipv4Address from, uint16_t port,
+                  std::unique_ptr<MutIOBuf> buf);
+  void SendUdp(Ipv4Address to, uint16_t port, uint16_t request_id,
+               std::unique_ptr<IOBuf> reply);
   void Quit();
-  void Flush();
+  void Flush(uint32_t exptime = 0);
+  uint32_t Generation(uint32_t now) const;
+  void Sweep(size_t remaining);
+  Shard &ShardFor(size_t hash);
+  void Track(TableEntry &);
+  void Schedule(TableEntry &, uint32_t expires);
+  void Charge(size_t owner, size_t bytes, size_t held);
+  void Uncharge(size_t owner, size_t bytes, size_t held);
+  void Reclaim();
+  void Nudge(size_t mycpu);
+  void Expire();
+  void UpdateLoad(CoreStore &);
+  size_t LeastLoaded() const;
+  void Reap();
+  void Unlink(TableEntry &, Shard &, CoreStore &);
+  void Retire(TableEntry &);
+  void MaybeResize(Shard &);
+  void Resize(Shard &);
+  void MigrateBuckets(Shard &);
   NetworkManager::ListeningTcpPcb listening_pcb_;
-  RcuHashTable<TableEntry, std::string, &TableEntry::hook, &TableEntry::key>
-      table_{13}; // 8k buckets
-  ebbrt::SpinLock table_lock_;
-  // fixme: below two are binary specific.. for now
+  NetworkManager::UdpPcb udp_pcb_;
+  uint16_t udp_port_{0};
+  SlabAllocator slab_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  size_t shard_mask_{0};
+  std::vector<std::unique_ptr<CoreStore>> cores_;
+  size_t memory_limit_{kDefaultMemoryLimit};
+  // resident_bytes of every core together, what memory_limit_ caps
+  std::atomic<size_t> resident_bytes_{0};
+  std::chrono::seconds report_interval_{0};
+  uint32_t start_time_;
+  bool track_latency_{true};
+  Placement placement_{Placement::kLeastLoaded};
+  bool rebalance_{false};
+  bool replicate_{true};
+  Reporter reporter_{this};
+  // The latest FLUSH: entries stored in generations up to the low half die
+  // once the time reaches the high half. Generation 0 is never stored.
+  std::atomic<uint64_t> flush_{0};
+  // entries below this generation died in earlier flushes
+  std::atomic<uint32_t> flushed_below_{0};
+  ebbrt::SpinLock flush_lock_;
+  // bound on second chances handed out per Reclaim()
+  static const constexpr size_t kClockScanMax = 64;
+  // expired entries reclaimed per Reap() before yielding to other events
+  static const constexpr size_t kReapBatch = 32;
+  // buckets rehashed per MigrateBuckets() before yielding to other events
+  static const constexpr size_t kMigrateBatch = 256;
+  // buckets written per SnapshotBatch() before yielding to other events
+  static const constexpr size_t kSnapshotBatch = 256;
+  // "MCDSNAP" and the format version
+  static const constexpr uint64_t kSnapshotMagic = 0x50414e5344434dull;
+  static const constexpr uint32_t kSnapshotVersion = 1;
+  // utilization (per mille) treated as equal when placing a connection
+  static const constexpr uint32_t kLoadStep = 50;
+  // utilization above the average at which a core sheds a connection
+  static const constexpr uint32_t kImbalance = 200;
+  // fixme: below is binary specific.. for now
   void Nop(protocol_binary_request_header &);
-  void Unimplemented(protocol_binary_request_header &);
 };
 } // namespace ebbrt
 
@@ -0,0 +1,355 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef RCURESIZABLEHASHTABLE_H
+#define RCURESIZABLEHASHTABLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <ebbrt/native/EventManager.h>
+
+namespace ebbrt {
+/**
+ * RcuResizableHook - an entry has one chain link per table generation, so
+ * while a resize is in flight it can be linked into the old and the new
+ * bucket array at once.
+ */
+template <typename T> class RcuResizableHook {
+public:
+  RcuResizableHook() {
+    next[0].store(nullptr, std::memory_order_relaxed);
+    next[1].store(nullptr, std::memory_order_relaxed);
+  }
+  std::atomic<T *> next[2];
+  // hash of the key, stored on insert so chain walks and rehashing never
+  // need the key itself
+  size_t hash{0};
+  // generations this entry is linked into, writer only
+  uint8_t linked{0};
+};
+
+/**
+ * RcuResizableHashTable - chained hash table with lock free lookups that
+ * grows and shrinks online. Writers are serialized by the caller.
+ *
+ * A resize publishes a new bucket array next to the old one. Buckets of the
+ * old array are then migrated a few at a time by subsequent writes (or by
+ * Migrate() from a background event): each entry is linked into the new
+ * array through its other generation link while staying on its old chain,
+ * so readers that still walk the old array miss nothing. Lookups that miss
+ * in the new array fall back to the old one until every bucket has moved,
+ * after which the old array is freed following an RCU grace period.
+ *
+ * Each bucket keeps a tag byte, taken from the top of the hash, for each
+ * of the first eight entries on its chain, next to the head. A lookup
+ * whose tag is not among them misses without touching any entry, and
+ * chain walks compare stored hashes before keys.
+ */
+template <typename T, typename Key, RcuResizableHook<T> T::*HookPtr,
+          Key T::*KeyPtr, typename Hash = std::hash<Key>>
+class RcuResizableHashTable {
+public:
+  /** Bucket - a chain head and the tags of its entries, see MayHold() */
+  struct Bucket {
+    std::atomic<T *> head;
+    std::atomic<uint64_t> tags;
+  };
+
+  class Buckets {
+  public:
+    Buckets(size_t bits, uint8_t generation)
+        : heads(new Bucket[size_t(1) << bits]),
+          mask((size_t(1) << bits) - 1), bits(bits), generation(generation) {
+      for (size_t i = 0; i <= mask; i++) {
+        heads[i].head.store(nullptr, std::memory_order_relaxed);
+        heads[i].tags.store(0, std::memory_order_relaxed);
+      }
+    }
+    size_t Count() const { return mask + 1; }
+    std::unique_ptr<Bucket[]> heads;
+    size_t mask;
+    size_t bits;
+    uint8_t generation;
+  };
+
+  RcuResizableHashTable(size_t bits, size_t min_bits)
+      : min_bits_(min_bits) {
+    cur_.store(new Buckets(bits, 0), std::memory_order_relaxed);
+  }
+  ~RcuResizableHashTable() {
+    delete cur_.load(std::memory_order_relaxed);
+    delete old_.load(std::memory_order_relaxed);
+  }
+
+  T *find(const Key &key) const { return find(key, Hash()(key)); }
+
+  /** find() - lookup with a hash the caller already computed
+   */
+  T *find(const Key &key, size_t hash) const {
+    // load the current array first: a writer publishes old_ before cur_
+    auto cur = cur_.load(std::memory_order_acquire);
+    auto old = old_.load(std::memory_order_acquire);
+    if (auto p = Search(*cur, hash, key)) {
+      return p;
+    }
+    if (old != nullptr) {
+      return Search(*old, hash, key);
+    }
+    return nullptr;
+  }
+
+  /** prefetch() - start loading the bucket head hash maps to. Batched
+   * lookups issue this for every key before the first find().
+   */
+  void prefetch(size_t hash) const {
+    auto cur = cur_.load(std::memory_order_acquire);
+    __builtin_prefetch(&cur->heads[hash & cur->mask]);
+  }
+
+  /** prefetch_chain() - once the bucket head is cached, start loading the
+   * first entry of its chain, unless the tags rule the key out
+   */
+  void prefetch_chain(size_t hash) const {
+    auto cur = cur_.load(std::memory_order_acquire);
+    auto &bucket = cur->heads[hash & cur->mask];
+    if (!MayHold(bucket.tags.load(std::memory_order_relaxed), Tag(hash))) {
+      return;
+    }
+    auto p = bucket.head.load(std::memory_order_relaxed);
+    if (p != nullptr) {
+      __builtin_prefetch(p);
+    }
+  }
+
+  /** Visit() - call f on every entry chained in buckets [first, first + n)
+   * of the current array and return the bucket to go on from, which is
+   * bucket_count() once the walk is done. Lock free like find(): entries
+   * written meanwhile may or may not be seen. While resizing() entries of
+   * buckets not yet migrated are only on the old array, so walks wait.
+   */
+  template <typename F> size_t Visit(size_t first, size_t n, F f) const {
+    auto cur = cur_.load(std::memory_order_acquire);
+    auto gen = cur->generation;
+    auto end = std::min(first + n, cur->Count());
+    for (auto i = first; i < end; i++) {
+      auto p = cur->heads[i].head.load(std::memory_order_consume);
+      while (p != nullptr) {
+        f(*p);
+        p = (p->*HookPtr).next[gen].load(std::memory_order_consume);
+      }
+    }
+    return end;
+  }
+
+  void insert(T &val) { insert(val, Hash()(val.*KeyPtr)); }
+
+  void insert(T &val, size_t hash) {
+    (val.*HookPtr).hash = hash;
+    auto cur = cur_.load(std::memory_order_relaxed);
+    Link(*cur, val, hash);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    Migrate(kMigrateStep);
+  }
+
+  void erase(T &val) {
+    auto hash = (val.*HookPtr).hash;
+    auto cur = cur_.load(std::memory_order_relaxed);
+    auto old = old_.load(std::memory_order_relaxed);
+    Unlink(*cur, val, hash);
+    if (old != nullptr) {
+      Unlink(*old, val, hash);
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    Migrate(kMigrateStep);
+  }
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+  size_t bucket_count() const {
+    return cur_.load(std::memory_order_relaxed)->Count();
+  }
+  double load_factor() const { return double(size()) / bucket_count(); }
+  bool resizing() const {
+    return old_.load(std::memory_order_relaxed) != nullptr;
+  }
+
+  /** DesiredBits() - log2 of the bucket count the table should move to, or
+   * zero if it is fine as is or a resize has not fully retired yet
+   */
+  size_t DesiredBits() const {
+    if (retiring_.load(std::memory_order_acquire)) {
+      return 0;
+    }
+    auto cur = cur_.load(std::memory_order_relaxed);
+    auto n = size();
+    if (n > cur->Count() * kGrowLoad) {
+      return cur->bits + 1;
+    }
+    if (cur->bits > min_bits_ && n * kShrinkLoad < cur->Count()) {
+      return cur->bits - 1;
+    }
+    return 0;
+  }
+
+  /** AllocateBuckets() - build the next bucket array, done outside of the
+   * writer lock since zeroing a large array is not cheap
+   */
+  std::unique_ptr<Buckets> AllocateBuckets(size_t bits) const {
+    auto generation = cur_.load(std::memory_order_relaxed)->generation ^ 1;
+    return std::unique_ptr<Buckets>(new Buckets(bits, generation));
+  }
+
+  /** BeginResize() - publish a new bucket array, migration starts with the
+   * next write. Returns false if a resize is already under way.
+   */
+  bool BeginResize(std::unique_ptr<Buckets> next) {
+    if (retiring_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    retiring_.store(true, std::memory_order_relaxed);
+    migrate_pos_ = 0;
+    old_.store(cur_.load(std::memory_order_relaxed),
+               std::memory_order_release);
+    cur_.store(next.release(), std::memory_order_release);
+    return true;
+  }
+
+  /** Migrate() - move up to nbuckets old buckets into the new array.
+   * Returns true while there is more to move.
+   */
+  bool Migrate(size_t nbuckets) {
+    auto old = old_.load(std::memory_order_relaxed);
+    if (old == nullptr) {
+      return false;
+    }
+    auto cur = cur_.load(std::memory_order_relaxed);
+    auto gen = old->generation;
+    for (; nbuckets > 0 && migrate_pos_ < old->Count(); nbuckets--) {
+      auto p = old->heads[migrate_pos_].head.load(std::memory_order_relaxed);
+      while (p != nullptr) {
+        Link(*cur, *p, (p->*HookPtr).hash);
+        p = (p->*HookPtr).next[gen].load(std::memory_order_relaxed);
+      }
+      migrate_pos_++;
+    }
+    if (migrate_pos_ < old->Count()) {
+      return true;
+    }
+    // Every entry is reachable from cur_, free the old array once no reader
+    // can still be walking it. Entries keep a stale bit for the old
+    // generation, Unlink() tolerates that.
+    old_.store(nullptr, std::memory_order_release);
+    event_manager->DoRcu([this, old]() {
+      delete old;
+      retiring_.store(false, std::memory_order_release);
+    });
+    return false;
+  }
+
+private:
+  static const constexpr size_t kGrowLoad = 2;    // entries per bucket
+  static const constexpr size_t kShrinkLoad = 8;  // i.e. 1/8 per bucket
+  static const constexpr size_t kMigrateStep = 8; // buckets per write
+  // tags of a bucket with more entries than tag bytes: every key may match
+  static const constexpr uint64_t kUntagged = ~uint64_t(0);
+  static const constexpr uint64_t kOnes = 0x0101010101010101ull;
+
+  /** Tag() - the top byte of hash, never zero since zero marks a free slot
+   */
+  static uint8_t Tag(size_t hash) {
+    uint8_t tag = uint64_t(hash) >> 56;
+    return tag != 0 ? tag : 1;
+  }
+
+  /** MayHold() - whether tag is among tags, a zero byte of tags ^ tag
+   * repeated (the word-at-a-time test for a zero byte)
+   */
+  static bool MayHold(uint64_t tags, uint8_t tag) {
+    auto v = tags ^ (kOnes * tag);
+    return tags == kUntagged || ((v - kOnes) & ~v & (kOnes << 7)) != 0;
+  }
+
+  static uint64_t AddTag(uint64_t tags, uint8_t tag) {
+    for (size_t shift = 0; shift < 64; shift += 8) {
+      if (((tags >> shift) & 0xff) == 0) {
+        return tags | uint64_t(tag) << shift;
+      }
+    }
+    return kUntagged;
+  }
+
+  static T *Search(const Buckets &b, size_t hash, const Key &key) {
+    auto gen = b.generation;
+    auto &bucket = b.heads[hash & b.mask];
+    if (!MayHold(bucket.tags.load(std::memory_order_relaxed), Tag(hash))) {
+      return nullptr;
+    }
+    auto p = bucket.head.load(std::memory_order_consume);
+    while (p != nullptr) {
+      if ((p->*HookPtr).hash == hash && p->*KeyPtr == key) {
+        return p;
+      }
+      p = (p->*HookPtr).next[gen].load(std::memory_order_consume);
+    }
+    return nullptr;
+  }
+
+  static void Link(Buckets &b, T &val, size_t hash) {
+    auto &hook = val.*HookPtr;
+    auto gen = b.generation;
+    auto &bucket = b.heads[hash & b.mask];
+    hook.next[gen].store(bucket.head.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+    hook.linked |= (1 << gen);
+    // the tag goes in first, so no reader finds val and rejects its key
+    bucket.tags.store(
+        AddTag(bucket.tags.load(std::memory_order_relaxed), Tag(hash)),
+        std::memory_order_relaxed);
+    bucket.head.store(&val, std::memory_order_release);
+  }
+
+  static void Unlink(Buckets &b, T &val, size_t hash) {
+    auto &hook = val.*HookPtr;
+    auto gen = b.generation;
+    if (!(hook.linked & (1 << gen))) {
+      return;
+    }
+    hook.linked &= ~(1 << gen);
+    auto &bucket = b.heads[hash & b.mask];
+    auto link = &bucket.head;
+    T *p;
+    while ((p = link->load(std::memory_order_relaxed)) != &val) {
+      if (p == nullptr) {
+        // stale bit left over from an earlier resize
+        return;
+      }
+      link = &(p->*HookPtr).next[gen];
+    }
+    // leave val's own link intact for readers already standing on it
+    link->store(hook.next[gen].load(std::memory_order_relaxed),
+                std::memory_order_release);
+    // retag from the entries left, val may no longer need its slot
+    uint64_t tags = 0;
+    for (p = bucket.head.load(std::memory_order_relaxed);
+         p != nullptr && tags != kUntagged;
+         p = (p->*HookPtr).next[gen].load(std::memory_order_relaxed)) {
+      tags = AddTag(tags, Tag((p->*HookPtr).hash));
+    }
+    bucket.tags.store(tags, std::memory_order_relaxed);
+  }
+
+  std::atomic<Buckets *> cur_{nullptr};
+  std::atomic<Buckets *> old_{nullptr};
+  // set from BeginResize() until the old array has been freed
+  std::atomic<bool> retiring_{false};
+  size_t migrate_pos_{0};
+  std::atomic<size_t> size_{0};
+  size_t min_bits_;
+};
+} // namespace ebbrt
+
+#endif // RCURESIZABLEHASHTABLE_H
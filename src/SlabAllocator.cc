@@ -0,0 +1,149 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+#include <cstdlib>
+#include <new>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Cpu.h>
+
+#include "SlabAllocator.h"
+
+ebbrt::SlabAllocator::SlabAllocator() {
+  for (size_t i = 0; i < Cpu::Count(); i++) {
+    cores_.emplace_back(new Core());
+  }
+}
+
+ebbrt::SlabAllocator::~SlabAllocator() {
+  for (auto &core : cores_) {
+    for (auto slab : core->slabs) {
+      std::free(slab);
+    }
+  }
+}
+
+size_t ebbrt::SlabAllocator::SizeClass(size_t size) {
+  size += sizeof(Header);
+  size_t c = 0;
+  while ((size_t(1) << (kMinShift + c)) < size) {
+    c++;
+  }
+  return c;
+}
+
+size_t ebbrt::SlabAllocator::ClassSize(size_t size) {
+  return size_t(1) << (kMinShift + SizeClass(size));
+}
+
+void *ebbrt::SlabAllocator::Alloc(size_t size) {
+  kassert(size <= MaxSize());
+  auto mycpu = size_t(Cpu::GetMine());
+  auto &core = *cores_[mycpu];
+  core.allocs++;
+  Header *h;
+  if (unlikely(bypass_)) {
+    h = static_cast<Header *>(::operator new(sizeof(Header) + size));
+    h->size_class = kBypassClass;
+  } else {
+    auto c = SizeClass(size);
+    core.class_allocs[c]++;
+    if (unlikely(core.free[c] == nullptr)) {
+      // reclaim objects other cores handed back before carving a new slab
+      core.free[c] =
+          core.remote[c].exchange(nullptr, std::memory_order_acquire);
+      if (core.free[c] == nullptr) {
+        Refill(core, c);
+      }
+    }
+    auto obj = core.free[c];
+    core.free[c] = obj->next;
+    h = reinterpret_cast<Header *>(obj);
+    h->size_class = c;
+  }
+  h->slab = this;
+  h->owner = mycpu;
+  return h + 1;
+}
+
+void ebbrt::SlabAllocator::Free(void *p) {
+  if (p == nullptr) {
+    return;
+  }
+  auto h = static_cast<Header *>(p) - 1;
+  h->slab->Release(h);
+}
+
+void ebbrt::SlabAllocator::Release(Header *h) {
+  if (unlikely(h->size_class == kBypassClass)) {
+    cores_[size_t(Cpu::GetMine())]->frees++;
+    ::operator delete(h);
+    return;
+  }
+  auto owner = h->owner;
+  auto c = h->size_class;
+  auto obj = reinterpret_cast<FreeObject *>(h);
+  if (likely(owner == size_t(Cpu::GetMine()))) {
+    auto &core = *cores_[owner];
+    core.frees++;
+    obj->next = core.free[c];
+    core.free[c] = obj;
+    return;
+  }
+  // Push onto the owner's remote list. The owner only ever takes the whole
+  // list at once, so a plain CAS push is free of ABA.
+  auto &core = *cores_[owner];
+  core.remote_frees.fetch_add(1, std::memory_order_relaxed);
+  auto head = core.remote[c].load(std::memory_order_relaxed);
+  do {
+    obj->next = head;
+  } while (!core.remote[c].compare_exchange_weak(
+      head, obj, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void ebbrt::SlabAllocator::Refill(Core &core, size_t size_class) {
+  auto obj_size = size_t(1) << (kMinShift + size_class);
+  auto slab = static_cast<uint8_t *>(std::malloc(kSlabSize));
+  kbugon(slab == nullptr, "SlabAllocator: out of memory\n");
+  core.slabs.push_back(slab);
+  core.class_slabs[size_class]++;
+  FreeObject *head = nullptr;
+  for (auto off = kSlabSize - obj_size;; off -= obj_size) {
+    auto obj = reinterpret_cast<FreeObject *>(slab + off);
+    obj->next = head;
+    head = obj;
+    if (off == 0)
+      break;
+  }
+  core.free[size_class] = head;
+}
+
+ebbrt::SlabAllocator::Stats ebbrt::SlabAllocator::GetStats() const {
+  Stats s = {};
+  for (auto &core : cores_) {
+    s.allocs += core->allocs;
+    s.frees += core->frees;
+    s.remote_frees += core->remote_frees.load(std::memory_order_relaxed);
+    s.slab_bytes += core->slabs.size() * kSlabSize;
+    for (size_t c = 0; c < kNumClasses; c++) {
+      s.class_allocs[c] += core->class_allocs[c];
+      s.class_slabs[c] += core->class_slabs[c];
+    }
+  }
+  s.frees += s.remote_frees;
+  return s;
+}
+
+ebbrt::SlabIOBufOwner::SlabIOBufOwner(SlabAllocator &slab, size_t capacity)
+    : buffer_(static_cast<uint8_t *>(slab.Alloc(capacity))),
+      capacity_(capacity) {}
+
+ebbrt::SlabIOBufOwner::~SlabIOBufOwner() { SlabAllocator::Free(buffer_); }
+
+std::unique_ptr<ebbrt::MutSlabIOBuf>
+ebbrt::MutSlabIOBuf::Create(SlabAllocator &slab, size_t capacity) {
+  return std::unique_ptr<MutSlabIOBuf>(new (slab)
+                                           MutSlabIOBuf(slab, capacity));
+}
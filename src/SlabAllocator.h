@@ -0,0 +1,135 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef SLABALLOCATOR_H
+#define SLABALLOCATOR_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <ebbrt/CacheAligned.h>
+#include <ebbrt/IOBuf.h>
+
+namespace ebbrt {
+/**
+ * SlabAllocator - per-core power-of-two size classes carved from large
+ * slabs. Every object carries a small header naming its allocator, owner
+ * core and class. Frees on the owner core go straight to its free list;
+ * frees from any other core are pushed onto the owner's lock-free remote
+ * list and reclaimed the next time the owner runs out of local objects.
+ */
+class SlabAllocator {
+public:
+  static const constexpr size_t kMinShift = 6;   // 64 byte class
+  static const constexpr size_t kNumClasses = 6; // ... 2048 byte class
+  static const constexpr size_t kSlabSize = 64 * 1024;
+
+  struct Stats {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t remote_frees;
+    size_t slab_bytes;
+    // per size class, bypassed allocations are not counted here
+    uint64_t class_allocs[kNumClasses];
+    size_t class_slabs[kNumClasses];
+  };
+
+  SlabAllocator();
+  ~SlabAllocator();
+  /** Alloc() - return at least size bytes, size must not exceed MaxSize()
+   */
+  void *Alloc(size_t size);
+  /** Free() - return an object to its owner, may be called from any core
+   */
+  static void Free(void *p);
+  /** ClassSize() - bytes actually reserved for a request of size bytes
+   */
+  static size_t ClassSize(size_t size);
+  static constexpr size_t MaxSize() {
+    return (1 << (kMinShift + kNumClasses - 1)) - sizeof(Header);
+  }
+  /** SetBypass() - serve requests from the general heap instead, used to
+   * compare against the slab path
+   */
+  void SetBypass(bool bypass) { bypass_ = bypass; }
+  Stats GetStats() const;
+
+private:
+  struct alignas(16) Header {
+    SlabAllocator *slab;
+    uint32_t owner;
+    uint32_t size_class;
+  };
+  struct FreeObject {
+    FreeObject *next;
+  };
+  class Core : public CacheAligned {
+  public:
+    Core() {
+      for (auto &r : remote) {
+        r.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    FreeObject *free[kNumClasses] = {};
+    std::atomic<FreeObject *> remote[kNumClasses];
+    std::vector<void *> slabs;
+    uint64_t allocs{0};
+    uint64_t frees{0};
+    uint64_t class_allocs[kNumClasses] = {};
+    size_t class_slabs[kNumClasses] = {};
+    // bumped by the freeing core
+    std::atomic<uint64_t> remote_frees{0};
+  };
+
+  static size_t SizeClass(size_t size);
+  void Release(Header *h);
+  void Refill(Core &core, size_t size_class);
+
+  static const constexpr uint32_t kBypassClass = ~0u;
+  std::vector<std::unique_ptr<Core>> cores_;
+  bool bypass_{false};
+};
+
+/**
+ * SlabIOBufOwner - buffer owner whose data lives in a SlabAllocator class,
+ * so small values can be stored without pinning the receive buffer.
+ */
+class SlabIOBufOwner {
+public:
+  SlabIOBufOwner(SlabAllocator &slab, size_t capacity);
+  ~SlabIOBufOwner();
+  SlabIOBufOwner(const SlabIOBufOwner &) = delete;
+  SlabIOBufOwner &operator=(const SlabIOBufOwner &) = delete;
+
+  const uint8_t *GetBuffer() const { return buffer_; }
+  size_t GetCapacity() const { return capacity_; }
+
+private:
+  uint8_t *buffer_;
+  size_t capacity_;
+};
+
+/**
+ * MutSlabIOBuf - the IOBuf object itself is also carved from the slab, so
+ * storing a small value costs no general heap allocation.
+ */
+class MutSlabIOBuf : public MutIOBufBase<SlabIOBufOwner> {
+public:
+  MutSlabIOBuf(SlabAllocator &slab, size_t capacity)
+      : MutIOBufBase<SlabIOBufOwner>(slab, capacity) {}
+
+  static std::unique_ptr<MutSlabIOBuf> Create(SlabAllocator &slab,
+                                              size_t capacity);
+  static void *operator new(size_t size, SlabAllocator &slab) {
+    return slab.Alloc(size);
+  }
+  static void operator delete(void *p, SlabAllocator &) {
+    SlabAllocator::Free(p);
+  }
+  static void operator delete(void *p) { SlabAllocator::Free(p); }
+};
+} // namespace ebbrt
+
+#endif // SLABALLOCATOR_H
@@ -0,0 +1,16 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef STATICEBBIDS_H
+#define STATICEBBIDS_H
+
+#include <ebbrt/EbbId.h>
+
+// Ebbs the hosted launcher and the native node both name
+enum : ebbrt::EbbId {
+  kCmdLineArgsId = ebbrt::kFirstStaticUserId,
+  kDatasetFeedId
+};
+
+#endif // STATICEBBIDS_H
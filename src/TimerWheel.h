@@ -0,0 +1,106 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <array>
+#include <cstdint>
+
+#include <boost/intrusive/list.hpp>
+
+namespace ebbrt {
+/**
+ * TimerWheel - hierarchical timing wheel over intrusively linked items with
+ * second granularity deadlines. Three levels of 256 slots cover about 194
+ * days; anything further out waits on an overflow list. Not thread safe,
+ * callers serialize access.
+ *
+ * Items are bucketed by the bits they share with the current time, so a
+ * level is cascaded into the one below exactly when time enters the range
+ * its slot covers.
+ */
+template <typename T, typename Hook, Hook T::*HookPtr, uint32_t T::*DeadlinePtr>
+class TimerWheel {
+public:
+  typedef boost::intrusive::list<
+      T, boost::intrusive::member_hook<T, Hook, HookPtr>,
+      boost::intrusive::constant_time_size<false>>
+      List;
+
+  explicit TimerWheel(uint32_t now) : now_(now) {}
+  ~TimerWheel() { Clear(); }
+
+  /** Insert() - schedule item at item.*DeadlinePtr
+   */
+  void Insert(T &item) {
+    auto deadline = item.*DeadlinePtr;
+    if (deadline <= now_) {
+      expired_.push_back(item);
+    } else if ((deadline >> kBits) == (now_ >> kBits)) {
+      wheel_[0][deadline & kMask].push_back(item);
+    } else if ((deadline >> (2 * kBits)) == (now_ >> (2 * kBits))) {
+      wheel_[1][(deadline >> kBits) & kMask].push_back(item);
+    } else if ((deadline >> (3 * kBits)) == (now_ >> (3 * kBits))) {
+      wheel_[2][(deadline >> (2 * kBits)) & kMask].push_back(item);
+    } else {
+      overflow_.push_back(item);
+    }
+  }
+
+  /** Advance() - move time forward to now and splice every item that came
+   * due onto the end of due
+   */
+  void Advance(uint32_t now, List &due) {
+    due.splice(due.end(), expired_);
+    while (now_ < now) {
+      now_++;
+      if ((now_ & kMask) == 0) {
+        if (((now_ >> kBits) & kMask) == 0) {
+          if (((now_ >> (2 * kBits)) & kMask) == 0) {
+            Cascade(overflow_);
+          }
+          Cascade(wheel_[2][(now_ >> (2 * kBits)) & kMask]);
+        }
+        Cascade(wheel_[1][(now_ >> kBits) & kMask]);
+      }
+      due.splice(due.end(), wheel_[0][now_ & kMask]);
+      due.splice(due.end(), expired_);
+    }
+  }
+
+  /** Clear() - unlink every scheduled item
+   */
+  void Clear() {
+    for (auto &level : wheel_) {
+      for (auto &slot : level) {
+        slot.clear();
+      }
+    }
+    overflow_.clear();
+    expired_.clear();
+  }
+
+private:
+  static const constexpr uint32_t kBits = 8;
+  static const constexpr uint32_t kMask = (1 << kBits) - 1;
+
+  void Cascade(List &slot) {
+    List tmp;
+    tmp.splice(tmp.end(), slot);
+    while (!tmp.empty()) {
+      auto &item = tmp.front();
+      tmp.pop_front();
+      Insert(item);
+    }
+  }
+
+  uint32_t now_;
+  std::array<std::array<List, kMask + 1>, 3> wheel_;
+  List overflow_;
+  List expired_;
+};
+} // namespace ebbrt
+
+#endif // TIMERWHEEL_H
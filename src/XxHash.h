@@ -0,0 +1,91 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace ebbrt {
+/**
+ * XxHash64 - Yann Collet's XXH64. Hash() consumes eight bytes per step,
+ * in four independent lanes for inputs of 32 bytes or more, where a
+ * bytewise hash combines one byte per step. Reads are unaligned.
+ */
+class XxHash64 {
+public:
+  static uint64_t Hash(const void *data, size_t len, uint64_t seed = 0) {
+    auto p = static_cast<const uint8_t *>(data);
+    auto end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+      uint64_t v1 = seed + kPrime1 + kPrime2;
+      uint64_t v2 = seed + kPrime2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - kPrime1;
+      for (; end - p >= 32; p += 32) {
+        v1 = Round(v1, Read64(p));
+        v2 = Round(v2, Read64(p + 8));
+        v3 = Round(v3, Read64(p + 16));
+        v4 = Round(v4, Read64(p + 24));
+      }
+      h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+      h = Merge(h, v1);
+      h = Merge(h, v2);
+      h = Merge(h, v3);
+      h = Merge(h, v4);
+    } else {
+      h = seed + kPrime5;
+    }
+    h += len;
+    for (; end - p >= 8; p += 8) {
+      h ^= Round(0, Read64(p));
+      h = Rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (end - p >= 4) {
+      uint32_t k;
+      std::memcpy(&k, p, sizeof(k));
+      h ^= uint64_t(k) * kPrime1;
+      h = Rotl(h, 23) * kPrime2 + kPrime3;
+      p += 4;
+    }
+    for (; p < end; p++) {
+      h ^= *p * kPrime5;
+      h = Rotl(h, 11) * kPrime1;
+    }
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+  }
+
+private:
+  static const constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ull;
+  static const constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4full;
+  static const constexpr uint64_t kPrime3 = 0x165667b19e3779f9ull;
+  static const constexpr uint64_t kPrime4 = 0x85ebca77c2b2ae63ull;
+  static const constexpr uint64_t kPrime5 = 0x27d4eb2f165667c5ull;
+
+  static uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  static uint64_t Read64(const uint8_t *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  static uint64_t Round(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    return Rotl(acc, 31) * kPrime1;
+  }
+  static uint64_t Merge(uint64_t acc, uint64_t v) {
+    acc ^= Round(0, v);
+    return acc * kPrime1 + kPrime4;
+  }
+};
+} // namespace ebbrt
+
+#endif // XXHASH_H
@@ -0,0 +1,617 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// Linux stand-ins for the native event, timer and network interfaces, so
+// the store, the protocol path and the benchmarks run as a plain process.
+// Like a native app, the program provides AppMain(), which runs on core 0.
+//
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ebbrt/CmdLineArgs.h>
+#include <ebbrt/UniqueIOBuf.h>
+#include <ebbrt/native/Cpu.h>
+#include <ebbrt/native/EventManager.h>
+#include <ebbrt/native/Net.h>
+#include <ebbrt/native/NetTcpHandler.h>
+#include <ebbrt/native/Timer.h>
+
+void AppMain();
+
+namespace ebbrt {
+/**
+ * EventLoop - one core: an epoll set, the work spawned locally, a locked
+ * queue other cores hand work through (kicked with an eventfd), the
+ * core's timers and the RCU callbacks it queued.
+ */
+class EventLoop : public EventManager::Watcher {
+public:
+  explicit EventLoop(size_t index);
+  [[noreturn]] void Run();
+  /** Post() - queue func to run on this loop, from any thread */
+  void Post(MovableFunction<void()> func);
+  void Ready(uint32_t events) override;
+  int Timeout() const;
+  void FireTimers();
+  void Quiesce();
+  bool GraceElapsed() const;
+
+  Cpu cpu;
+  int epfd;
+  int kick;
+  std::deque<MovableFunction<void()>> local;
+  std::mutex lock;
+  std::vector<MovableFunction<void()>> remote;
+  std::vector<Timer::Hook *> timers;
+  // queued by DoRcu(), and the batch waiting out a grace period
+  std::vector<MovableFunction<void()>> rcu_current;
+  std::vector<MovableFunction<void()>> rcu_waiting;
+  std::vector<uint64_t> rcu_snapshot;
+  // odd while running an event, even while blocked in epoll_wait()
+  std::atomic<uint64_t> state{0};
+};
+
+namespace {
+const constexpr size_t kMaxEvents = 64;
+const constexpr size_t kReadSize = 16 * 1024;
+const constexpr size_t kMaxIov = 64;
+
+std::vector<std::unique_ptr<EventLoop>> loops;
+thread_local EventLoop *my_loop = nullptr;
+EventManager the_event_manager;
+Timer the_timer;
+
+[[noreturn]] void Fatal(const char *what) {
+  std::perror(what);
+  std::abort();
+}
+
+EventLoop &MyLoop() {
+  if (my_loop == nullptr) {
+    std::fprintf(stderr, "not on an event loop\n");
+    std::abort();
+  }
+  return *my_loop;
+}
+} // namespace
+
+EventManager *const event_manager = &the_event_manager;
+Timer *const timer = &the_timer;
+
+Cpu &Cpu::GetMine() { return MyLoop().cpu; }
+
+size_t Cpu::Count() { return loops.size(); }
+
+EventLoop::EventLoop(size_t index) : cpu(index) {
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    Fatal("epoll_create1");
+  }
+  kick = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (kick < 0) {
+    Fatal("eventfd");
+  }
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.ptr = static_cast<EventManager::Watcher *>(this);
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, kick, &ev) < 0) {
+    Fatal("epoll_ctl");
+  }
+}
+
+void EventLoop::Run() {
+  my_loop = this;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(size_t(cpu) % std::thread::hardware_concurrency(), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  epoll_event events[kMaxEvents];
+  while (true) {
+    auto n = epoll_wait(epfd, events, kMaxEvents, Timeout());
+    if (n < 0 && errno != EINTR) {
+      Fatal("epoll_wait");
+    }
+    state.fetch_add(1);
+    for (int i = 0; i < n; i++) {
+      static_cast<EventManager::Watcher *>(events[i].data.ptr)
+          ->Ready(events[i].events);
+    }
+    FireTimers();
+    // work spawned from here on waits for the next round
+    for (auto count = local.size(); count > 0; count--) {
+      auto func = std::move(local.front());
+      local.pop_front();
+      func();
+    }
+    Quiesce();
+    state.fetch_add(1);
+  }
+}
+
+void EventLoop::Post(MovableFunction<void()> func) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    remote.emplace_back(std::move(func));
+  }
+  uint64_t one = 1;
+  if (write(kick, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    Fatal("write");
+  }
+}
+
+void EventLoop::Ready(uint32_t events) {
+  uint64_t count;
+  if (read(kick, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    Fatal("read");
+  }
+  std::vector<MovableFunction<void()>> funcs;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    funcs.swap(remote);
+  }
+  for (auto &func : funcs) {
+    local.emplace_back(std::move(func));
+  }
+}
+
+/**
+ * Timeout() - how long epoll_wait() may block: not at all with work
+ * queued, until the next timer otherwise, and briefly while RCU callbacks
+ * wait on other loops
+ */
+int EventLoop::Timeout() const {
+  if (!local.empty()) {
+    return 0;
+  }
+  int timeout = -1;
+  if (!rcu_current.empty() || !rcu_waiting.empty()) {
+    timeout = 1;
+  }
+  auto now = std::chrono::steady_clock::now();
+  for (auto hook : timers) {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  hook->deadline_ - now)
+                  .count() +
+              1;
+    ms = std::max<decltype(ms)>(ms, 0);
+    if (timeout < 0 || ms < timeout) {
+      timeout = ms;
+    }
+  }
+  return timeout;
+}
+
+void EventLoop::FireTimers() {
+  auto now = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < timers.size();) {
+    auto hook = timers[i];
+    if (hook->deadline_ > now) {
+      i++;
+      continue;
+    }
+    if (hook->repeat_) {
+      hook->deadline_ = now + hook->interval_;
+      i++;
+    } else {
+      hook->armed_ = false;
+      timers.erase(timers.begin() + i);
+    }
+    hook->Fire();
+  }
+}
+
+/**
+ * Quiesce() - run the waiting batch of RCU callbacks once its grace period
+ * has passed, then start one for whatever was queued since
+ */
+void EventLoop::Quiesce() {
+  if (!rcu_waiting.empty() && GraceElapsed()) {
+    auto ready = std::move(rcu_waiting);
+    rcu_waiting.clear();
+    for (auto &func : ready) {
+      func();
+    }
+  }
+  if (rcu_waiting.empty() && !rcu_current.empty()) {
+    rcu_waiting.swap(rcu_current);
+    rcu_snapshot.resize(loops.size());
+    // Order the unlinks these callbacks wait on before the loads below.
+    // Pairs with the seq_cst fetch_add a loop enters an event with, so a
+    // loop that reads a removed pointer is seen inside its event.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (size_t i = 0; i < loops.size(); i++) {
+      rcu_snapshot[i] = loops[i]->state.load();
+    }
+  }
+}
+
+/**
+ * GraceElapsed() - every loop that was inside an event at the snapshot has
+ * since left it
+ */
+bool EventLoop::GraceElapsed() const {
+  for (size_t i = 0; i < loops.size(); i++) {
+    auto s = rcu_snapshot[i];
+    if ((s & 1) && loops[i]->state.load() == s) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void EventManager::SpawnLocal(MovableFunction<void()> func, bool force_async) {
+  MyLoop().local.emplace_back(std::move(func));
+}
+
+void EventManager::SpawnRemote(MovableFunction<void()> func, size_t cpu) {
+  loops[cpu]->Post(std::move(func));
+}
+
+void EventManager::DoRcu(MovableFunction<void()> func) {
+  MyLoop().rcu_current.emplace_back(std::move(func));
+}
+
+void EventManager::Watch(int fd, Watcher *w, size_t cpu, uint32_t events) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = w;
+  if (epoll_ctl(loops[cpu]->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    Fatal("epoll_ctl");
+  }
+}
+
+void EventManager::Modify(int fd, Watcher *w, size_t cpu, uint32_t events) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = w;
+  if (epoll_ctl(loops[cpu]->epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    Fatal("epoll_ctl");
+  }
+}
+
+void EventManager::Unwatch(int fd, size_t cpu) {
+  epoll_ctl(loops[cpu]->epfd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Timer::Start(Hook &hook, std::chrono::microseconds timeout,
+                  bool repeat) {
+  hook.deadline_ = std::chrono::steady_clock::now() + timeout;
+  hook.interval_ = timeout;
+  hook.repeat_ = repeat;
+  if (!hook.armed_) {
+    hook.armed_ = true;
+    MyLoop().timers.push_back(&hook);
+  }
+}
+
+void Timer::Stop(Hook &hook) {
+  if (!hook.armed_) {
+    return;
+  }
+  hook.armed_ = false;
+  auto &timers = MyLoop().timers;
+  timers.erase(std::find(timers.begin(), timers.end(), &hook));
+}
+
+NetworkManager::ListeningTcpPcb::~ListeningTcpPcb() {
+  if (fd_ >= 0) {
+    event_manager->Unwatch(fd_, cpu_);
+    close(fd_);
+  }
+}
+
+uint16_t
+NetworkManager::ListeningTcpPcb::Bind(uint16_t port,
+                                      MovableFunction<void(TcpPcb)> accept) {
+  fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    Fatal("socket");
+  }
+  int one = 1;
+  setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    Fatal("bind");
+  }
+  if (listen(fd_, SOMAXCONN) < 0) {
+    Fatal("listen");
+  }
+  socklen_t len = sizeof(addr);
+  getsockname(fd_, reinterpret_cast<sockaddr *>(&addr), &len);
+  cpu_ = Cpu::GetMine();
+  accept_ = std::move(accept);
+  event_manager->Watch(fd_, this, cpu_, EPOLLIN);
+  return ntohs(addr.sin_port);
+}
+
+void NetworkManager::ListeningTcpPcb::Ready(uint32_t events) {
+  while (true) {
+    auto fd = accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    accept_(TcpPcb(fd, cpu_));
+  }
+}
+
+NetworkManager::UdpPcb::~UdpPcb() {
+  for (size_t i = 0; i < sockets_.size(); i++) {
+    event_manager->Unwatch(sockets_[i]->fd(), i);
+    close(sockets_[i]->fd());
+  }
+}
+
+uint16_t NetworkManager::UdpPcb::Bind(uint16_t port) {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (size_t i = 0; i < Cpu::Count(); i++) {
+    auto fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      Fatal("socket");
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+      Fatal("bind");
+    }
+    // the rest join whatever port the first was given
+    socklen_t len = sizeof(addr);
+    getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+    sockets_.emplace_back(new Socket(this, fd));
+    event_manager->Watch(fd, sockets_.back().get(), i, EPOLLIN);
+  }
+  return ntohs(addr.sin_port);
+}
+
+void NetworkManager::UdpPcb::Socket::Ready(uint32_t events) {
+  while (true) {
+    auto buf = MakeUniqueIOBuf(kReadSize);
+    sockaddr_in from;
+    iovec iov = {buf->MutData(), kReadSize};
+    msghdr msg = {};
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    auto n = recvmsg(fd_, &msg, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if (msg.msg_flags & MSG_TRUNC) {
+      continue;
+    }
+    buf->TrimEnd(kReadSize - n);
+    pcb_->receive_(Ipv4Address(from.sin_addr.s_addr), ntohs(from.sin_port),
+                   std::move(buf));
+  }
+}
+
+void NetworkManager::UdpPcb::SendTo(Ipv4Address addr, uint16_t port,
+                                    std::unique_ptr<IOBuf> buf) {
+  iovec iov[kMaxIov];
+  size_t n = 0;
+  for (auto &b : *buf) {
+    if (n == kMaxIov) {
+      return;
+    }
+    iov[n].iov_base = const_cast<uint8_t *>(b.Data());
+    iov[n].iov_len = b.Length();
+    n++;
+  }
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  to.sin_addr.s_addr = addr.toU32();
+  msghdr msg = {};
+  msg.msg_name = &to;
+  msg.msg_namelen = sizeof(to);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+  // a datagram the socket has no room for is lost, as on the wire
+  while (sendmsg(sockets_[Cpu::GetMine()]->fd(), &msg, 0) < 0 &&
+         errno == EINTR) {
+  }
+}
+
+TcpHandler::~TcpHandler() { Shutdown(); }
+
+void TcpHandler::Install() {
+  watched_ = pcb_.cpu();
+  event_manager->Watch(pcb_.fd(), this, watched_, Interest());
+}
+
+uint32_t TcpHandler::Interest() const {
+  return EPOLLIN | EPOLLRDHUP | (want_write_ ? EPOLLOUT : 0);
+}
+
+void TcpHandler::Shutdown() {
+  auto fd = pcb_.fd();
+  if (fd < 0) {
+    return;
+  }
+  event_manager->Unwatch(fd, watched_);
+  close(fd);
+  pcb_ = NetworkManager::TcpPcb();
+  pending_.reset();
+}
+
+void TcpHandler::Ready(uint32_t events) {
+  if (events & EPOLLOUT) {
+    Flush();
+  }
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+    Read();
+  }
+  if (pcb_.fd() >= 0 && pcb_.cpu() != watched_) {
+    // rebound by Receive(), hand the socket to the new core's loop
+    event_manager->Unwatch(pcb_.fd(), watched_);
+    watched_ = pcb_.cpu();
+    event_manager->Watch(pcb_.fd(), this, watched_, Interest());
+  }
+}
+
+void TcpHandler::Read() {
+  while (pcb_.fd() >= 0) {
+    auto buf = MakeUniqueIOBuf(kReadSize);
+    auto n = read(pcb_.fd(), buf->MutData(), kReadSize);
+    if (n > 0) {
+      buf->TrimEnd(kReadSize - n);
+      Receive(std::move(buf));
+      if (size_t(n) < kReadSize) {
+        return;
+      }
+      continue;
+    }
+    if (n == 0) {
+      Shutdown();
+      Close();
+      return;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      Shutdown();
+      Abort();
+    }
+    return;
+  }
+}
+
+void TcpHandler::Send(std::unique_ptr<IOBuf> buf) {
+  if (pcb_.fd() < 0) {
+    return;
+  }
+  if (pending_) {
+    pending_->PrependChain(std::move(buf));
+  } else {
+    pending_ = std::move(buf);
+  }
+  if (!want_write_) {
+    Flush();
+  }
+}
+
+/**
+ * Flush() - write queued data until the socket pushes back, then wait for
+ * it to become writable again
+ */
+void TcpHandler::Flush() {
+  auto fd = pcb_.fd();
+  while (pending_) {
+    iovec iov[kMaxIov];
+    size_t n = 0;
+    for (auto &b : *pending_) {
+      if (n == kMaxIov) {
+        break;
+      }
+      if (b.Length() == 0) {
+        continue;
+      }
+      iov[n].iov_base = const_cast<uint8_t *>(b.Data());
+      iov[n].iov_len = b.Length();
+      n++;
+    }
+    if (n == 0) {
+      pending_.reset();
+      break;
+    }
+    auto written = writev(fd, iov, n);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (!want_write_) {
+          want_write_ = true;
+          event_manager->Modify(fd, this, watched_, Interest());
+        }
+        return;
+      }
+      Shutdown();
+      Abort();
+      return;
+    }
+    pending_->AdvanceChain(written);
+    while (pending_ && pending_->Length() == 0) {
+      pending_ = pending_->Pop();
+    }
+  }
+  if (want_write_) {
+    want_write_ = false;
+    event_manager->Modify(fd, this, watched_, Interest());
+  }
+}
+} // namespace ebbrt
+
+namespace {
+int app_argc;
+char **app_argv;
+} // namespace
+
+int ebbrt::CmdLineArgs::Argc() { return app_argc; }
+
+char **ebbrt::CmdLineArgs::Argv() { return app_argv; }
+
+/**
+ * main() - memcached-linux [cores] [args]: one event loop per core,
+ * defaulting to every processor, with AppMain() started on the first. The
+ * arguments after the core count are left to CmdLineArgs.
+ */
+int main(int argc, char **argv) {
+  size_t ncpus = std::thread::hardware_concurrency();
+  app_argc = argc;
+  app_argv = argv;
+  if (argc > 1 && argv[1][0] >= '0' && argv[1][0] <= '9') {
+    ncpus = std::strtoul(argv[1], nullptr, 10);
+    // the program name takes the place of the count
+    argv[1] = argv[0];
+    app_argc = argc - 1;
+    app_argv = argv + 1;
+  }
+  if (ncpus == 0) {
+    ncpus = 1;
+  }
+  using ebbrt::loops;
+  for (size_t i = 0; i < ncpus; i++) {
+    loops.emplace_back(new ebbrt::EventLoop(i));
+  }
+  loops[0]->Post([]() { AppMain(); });
+  for (size_t i = 1; i < ncpus; i++) {
+    std::thread([i]() { loops[i]->Run(); }).detach();
+  }
+  loops[0]->Run();
+}
@@ -0,0 +1,22 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LINUX_EBBRT_CMDLINEARGS_H
+#define LINUX_EBBRT_CMDLINEARGS_H
+
+namespace ebbrt {
+/**
+ * CmdLineArgs - what the Linux launcher in Runtime.cc passes on to the
+ * application: the program name followed by every argument after the core
+ * count, in the argc/argv form getopt() takes. Native apps read the
+ * hosted launcher's arguments from the ebbrt-cmdline Ebb instead.
+ */
+class CmdLineArgs {
+public:
+  static int Argc();
+  static char **Argv();
+};
+} // namespace ebbrt
+
+#endif // LINUX_EBBRT_CMDLINEARGS_H
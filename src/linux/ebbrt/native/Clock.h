@@ -0,0 +1,31 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LINUX_EBBRT_NATIVE_CLOCK_H
+#define LINUX_EBBRT_NATIVE_CLOCK_H
+
+#include <chrono>
+
+namespace ebbrt {
+namespace clock {
+/**
+ * Wall - nanosecond wall clock time, read through the vDSO
+ */
+class Wall {
+public:
+  typedef std::chrono::nanoseconds duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef std::chrono::time_point<Wall> time_point;
+  static const bool is_steady = false;
+
+  static time_point Now() noexcept {
+    return time_point(std::chrono::duration_cast<duration>(
+        std::chrono::system_clock::now().time_since_epoch()));
+  }
+};
+} // namespace clock
+} // namespace ebbrt
+
+#endif // LINUX_EBBRT_NATIVE_CLOCK_H
@@ -0,0 +1,38 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LINUX_EBBRT_NATIVE_CPU_H
+#define LINUX_EBBRT_NATIVE_CPU_H
+
+#include <cstddef>
+
+#include <ebbrt/Debug.h>
+
+// the native kernel headers provide these
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+namespace ebbrt {
+/**
+ * Cpu - in the Linux build a core is one event loop thread, pinned to the
+ * processor of the same index. GetMine() must be called from a loop.
+ */
+class Cpu {
+public:
+  static Cpu &GetMine();
+  static size_t Count();
+  operator size_t() const { return index_; }
+
+private:
+  friend class EventLoop;
+  explicit Cpu(size_t index) : index_(index) {}
+  size_t index_;
+};
+} // namespace ebbrt
+
+#endif // LINUX_EBBRT_NATIVE_CPU_H
@@ -0,0 +1,47 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LINUX_EBBRT_NATIVE_EVENTMANAGER_H
+#define LINUX_EBBRT_NATIVE_EVENTMANAGER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ebbrt/MoveLambda.h>
+
+#include "Cpu.h"
+
+namespace ebbrt {
+/**
+ * EventManager - the native event interface over one epoll loop per core.
+ * Everything a loop runs between two epoll_wait() calls counts as a single
+ * event, and a loop blocked in epoll_wait() is quiescent, so DoRcu()
+ * callbacks run once every loop has been seen outside the events that were
+ * in flight when they were queued.
+ */
+class EventManager {
+public:
+  /** Watcher - target of readiness events on a file descriptor */
+  class Watcher {
+  public:
+    virtual ~Watcher() {}
+    virtual void Ready(uint32_t events) = 0;
+  };
+
+  void SpawnLocal(MovableFunction<void()> func, bool force_async = false);
+  void SpawnRemote(MovableFunction<void()> func, size_t cpu);
+  void DoRcu(MovableFunction<void()> func);
+
+  /** Watch() - deliver epoll events for fd to w on the given core. Linux
+   * only, used by the network stand-ins.
+   */
+  void Watch(int fd, Watcher *w, size_t cpu, uint32_t events);
+  void Modify(int fd, Watcher *w, size_t cpu, uint32_t events);
+  void Unwatch(int fd, size_t cpu);
+};
+
+extern EventManager *const event_manager;
+} // namespace ebbrt
+
+#endif // LINUX_EBBRT_NATIVE_EVENTMANAGER_H
@@ -0,0 +1,112 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LINUX_EBBRT_NATIVE_NET_H
+#define LINUX_EBBRT_NATIVE_NET_H
+
+#include <arpa/inet.h>
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <ebbrt/IOBuf.h>
+#include <ebbrt/MoveLambda.h>
+
+#include "EventManager.h"
+
+namespace ebbrt {
+/** Ipv4Address - an address in network byte order */
+class Ipv4Address {
+public:
+  Ipv4Address() {}
+  explicit Ipv4Address(uint32_t addr) : addr_(addr) {}
+  uint32_t toU32() const { return addr_; }
+
+private:
+  uint32_t addr_{0};
+};
+
+/**
+ * NetworkManager - TCP and UDP over the host's sockets, on loopback.
+ * Connections are accepted on the core that called Bind() and served by
+ * the event loop of the core they are bound to.
+ */
+class NetworkManager {
+public:
+  class TcpPcb {
+  public:
+    TcpPcb() {}
+    TcpPcb(int fd, size_t cpu) : fd_(fd), cpu_(cpu) {}
+    TcpPcb(TcpPcb &&other) : fd_(other.fd_), cpu_(other.cpu_) {
+      other.fd_ = -1;
+    }
+    TcpPcb &operator=(TcpPcb &&other) {
+      std::swap(fd_, other.fd_);
+      cpu_ = other.cpu_;
+      return *this;
+    }
+    TcpPcb(const TcpPcb &) = delete;
+    TcpPcb &operator=(const TcpPcb &) = delete;
+    void BindCpu(size_t cpu) { cpu_ = cpu; }
+    int fd() const { return fd_; }
+    size_t cpu() const { return cpu_; }
+
+  private:
+    int fd_{-1};
+    size_t cpu_{0};
+  };
+
+  class ListeningTcpPcb : public EventManager::Watcher {
+  public:
+    ~ListeningTcpPcb();
+    uint16_t Bind(uint16_t port, MovableFunction<void(TcpPcb)> accept);
+    void Ready(uint32_t events) override;
+
+  private:
+    int fd_{-1};
+    size_t cpu_{0};
+    MovableFunction<void(TcpPcb)> accept_;
+  };
+
+  /**
+   * UdpPcb - a UDP port with one SO_REUSEPORT socket per core, each read
+   * by its core's loop, so the kernel steers a flow's datagrams to one
+   * core the way RSS does on the native NIC. Receive() is called on the
+   * core a datagram arrived on; SendTo() goes out through the calling
+   * core's socket and is dropped if that socket is full.
+   */
+  class UdpPcb {
+  public:
+    typedef MovableFunction<void(Ipv4Address, uint16_t,
+                                 std::unique_ptr<MutIOBuf>)>
+        ReceiveFunc;
+    UdpPcb() {}
+    UdpPcb(const UdpPcb &) = delete;
+    UdpPcb &operator=(const UdpPcb &) = delete;
+    ~UdpPcb();
+    uint16_t Bind(uint16_t port);
+    void Receive(ReceiveFunc func) { receive_ = std::move(func); }
+    void SendTo(Ipv4Address addr, uint16_t port, std::unique_ptr<IOBuf> buf);
+
+  private:
+    class Socket : public EventManager::Watcher {
+    public:
+      Socket(UdpPcb *pcb, int fd) : pcb_(pcb), fd_(fd) {}
+      void Ready(uint32_t events) override;
+      int fd() const { return fd_; }
+
+    private:
+      UdpPcb *pcb_;
+      int fd_;
+    };
+    // indexed by core
+    std::vector<std::unique_ptr<Socket>> sockets_;
+    ReceiveFunc receive_;
+  };
+};
+} // namespace ebbrt
+
+#endif // LINUX_EBBRT_NATIVE_NET_H
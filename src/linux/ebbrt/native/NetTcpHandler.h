@@ -0,0 +1,46 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LINUX_EBBRT_NATIVE_NETTCPHANDLER_H
+#define LINUX_EBBRT_NATIVE_NETTCPHANDLER_H
+
+#include <memory>
+
+#include "Net.h"
+
+namespace ebbrt {
+/**
+ * TcpHandler - a connection driven by its core's event loop. Receive() is
+ * handed each read as it comes off the socket. Send() writes what the
+ * socket takes right away and queues the rest until it is writable. A
+ * Receive() that binds pcb_ to another core moves the connection to that
+ * core's loop once it returns.
+ */
+class TcpHandler : public EventManager::Watcher {
+public:
+  explicit TcpHandler(NetworkManager::TcpPcb pcb) : pcb_(std::move(pcb)) {}
+  virtual ~TcpHandler();
+  virtual void Receive(std::unique_ptr<MutIOBuf> buf) = 0;
+  virtual void Close() = 0;
+  virtual void Abort() = 0;
+  void Install();
+  void Send(std::unique_ptr<IOBuf> buf);
+  void Shutdown();
+  void Ready(uint32_t events) override;
+
+protected:
+  NetworkManager::TcpPcb pcb_;
+
+private:
+  void Read();
+  void Flush();
+  uint32_t Interest() const;
+  std::unique_ptr<IOBuf> pending_;
+  bool want_write_{false};
+  // core whose loop watches the socket
+  size_t watched_{0};
+};
+} // namespace ebbrt
+
+#endif // LINUX_EBBRT_NATIVE_NETTCPHANDLER_H
@@ -0,0 +1,38 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LINUX_EBBRT_NATIVE_TIMER_H
+#define LINUX_EBBRT_NATIVE_TIMER_H
+
+#include <chrono>
+
+namespace ebbrt {
+/**
+ * Timer - per-core timers fired from the core's event loop. A hook belongs
+ * to the core that started it.
+ */
+class Timer {
+public:
+  class Hook {
+  public:
+    virtual ~Hook() {}
+    virtual void Fire() = 0;
+
+  private:
+    friend class EventLoop;
+    friend class Timer;
+    std::chrono::steady_clock::time_point deadline_;
+    std::chrono::microseconds interval_{0};
+    bool repeat_{false};
+    bool armed_{false};
+  };
+
+  void Start(Hook &hook, std::chrono::microseconds timeout, bool repeat);
+  void Stop(Hook &hook);
+};
+
+extern Timer *const timer;
+} // namespace ebbrt
+
+#endif // LINUX_EBBRT_NATIVE_TIMER_H
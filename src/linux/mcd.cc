@@ -0,0 +1,103 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+// memcached-linux: the server of src/mcd.cpp as a Linux process, listening
+// on loopback (TCP, and UDP for GETs) with one event loop per core.
+// --preload FILE bulk loads a dataset (see Dataset.h) on every core before
+// the server starts.
+//
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+
+#include <ebbrt/CmdLineArgs.h>
+#include <ebbrt/Debug.h>
+#include <ebbrt/native/Clock.h>
+#include <ebbrt/native/Net.h>
+
+#include "Memcached.h"
+
+#define MCDPORT 11211
+#define MCDMEMLIMIT (1ull << 30) // bytes
+#define MCDREPORTSECS 10
+#define MCDSHARDSPERCORE 4
+
+namespace {
+void Start(ebbrt::Memcached *mc) {
+  mc->Start(MCDPORT);
+  ebbrt::kprintf("Memcached server listening on 127.0.0.1:%d (TCP and UDP) "
+                 "with %zu cores\n",
+                 MCDPORT, ebbrt::Cpu::Count());
+}
+
+/**
+ * Preload() - map path and have every core store its share of the
+ * dataset, then start the server
+ */
+void Preload(ebbrt::Memcached *mc, const char *path) {
+  auto fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    ebbrt::kprintf("memcached: cannot open %s\n", path);
+    std::exit(1);
+  }
+  size_t len = st.st_size;
+  void *data = nullptr;
+  if (len > 0) {
+    data = mmap(nullptr, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED) {
+      ebbrt::kprintf("memcached: cannot map %s\n", path);
+      std::exit(1);
+    }
+  }
+  close(fd);
+  auto start = ebbrt::clock::Wall::Now();
+  mc->Preload(data, len, [mc, path, data, len, start](size_t items, bool ok) {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  ebbrt::clock::Wall::Now() - start)
+                  .count();
+    ebbrt::kprintf("memcached: preloaded %zu items from %s in %lldms%s\n",
+                   items, path, (long long)ms,
+                   ok ? "" : ", stopped at a malformed block");
+    if (data) {
+      munmap(data, len);
+    }
+    Start(mc);
+  });
+}
+} // namespace
+
+void AppMain() {
+  static const option longopts[] = {{"preload", required_argument, 0, 'p'},
+                                    {0, 0, 0, 0}};
+  const char *preload = nullptr;
+  int ch;
+  while ((ch = getopt_long(ebbrt::CmdLineArgs::Argc(),
+                           ebbrt::CmdLineArgs::Argv(), "", longopts,
+                           nullptr)) != -1) {
+    if (ch != 'p') {
+      ebbrt::kprintf("usage: memcached-linux [cores] [--preload FILE]\n");
+      std::exit(2);
+    }
+    preload = optarg;
+  }
+
+  auto mc = new ebbrt::Memcached();
+  mc->SetShards(ebbrt::Cpu::Count() * MCDSHARDSPERCORE);
+  mc->SetMemoryLimit(MCDMEMLIMIT);
+  mc->SetReportInterval(std::chrono::seconds(MCDREPORTSECS));
+  // a connection moves by rebinding its socket to another loop
+  mc->SetRebalancing(true);
+  mc->SetUdpPort(MCDPORT);
+  if (preload) {
+    Preload(mc, preload);
+  } else {
+    Start(mc);
+  }
+}
@@ -1,15 +1,69 @@
+#include <getopt.h>
+
 #include <ebbrt/Debug.h>
 #include <ebbrt/EbbAllocator.h>
+#include <ebbrt/native/Clock.h>
 #include <ebbrt/native/Net.h>
+#include <ebbrt-cmdline/CmdLineArgs.h>
+#include "DatasetFeed.h"
 #include "Memcached.h"
+#include "StaticEbbIds.h"
 
 #define MCDPORT 11211
+#define MCDMEMLIMIT (1ull << 30) // bytes
+#define MCDREPORTSECS 10
+#define MCDSHARDSPERCORE 4
+
+namespace {
+void Start(ebbrt::EbbRef<ebbrt::Memcached> mc) {
+  mc->Start(MCDPORT);
+  ebbrt::kprintf("Memcached server listening on port %d (TCP and UDP)\n",
+                 MCDPORT);
+}
+
+/**
+ * Preload() - store the dataset the hosted launcher was given, then start
+ * the server
+ */
+void Preload(ebbrt::EbbRef<ebbrt::Memcached> mc) {
+  auto start = ebbrt::clock::Wall::Now();
+  ebbrt::EbbRef<ebbrt::DatasetFeed>(kDatasetFeedId)
+      ->Load(mc, [mc, start](size_t items, bool ok) {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      ebbrt::clock::Wall::Now() - start)
+                      .count();
+        ebbrt::kprintf("memcached: preloaded %zu items in %lldms%s\n", items,
+                       (long long)ms,
+                       ok ? "" : ", stopped at a malformed block");
+        Start(mc);
+      });
+}
+} // namespace
 
 void AppMain()
 {
+  // the launcher checked the arguments, we only look for --preload
+  auto args = ebbrt::EbbRef<CmdLineArgs>(kCmdLineArgsId);
+  static const option longopts[] = {{"preload", required_argument, 0, 'p'},
+                                    {0, 0, 0, 0}};
+  bool preload = false;
+  int ch;
+  opterr = 0;
+  while ((ch = getopt_long(args->argc(), args->argv(), "", longopts,
+                           nullptr)) != -1) {
+    preload |= ch == 'p';
+  }
+
   auto id = ebbrt::ebb_allocator->AllocateLocal();
   auto mc = ebbrt::EbbRef<ebbrt::Memcached>(id);
-  mc->Start(MCDPORT);
-  ebbrt::kprintf("Memcached server listening on port %d\n", MCDPORT);
+  mc->SetShards(ebbrt::Cpu::Count() * MCDSHARDSPERCORE);
+  mc->SetMemoryLimit(MCDMEMLIMIT);
+  mc->SetReportInterval(std::chrono::seconds(MCDREPORTSECS));
+  // GETs are also served over UDP on the same port
+  mc->SetUdpPort(MCDPORT);
+  if (preload) {
+    Preload(mc);
+  } else {
+    Start(mc);
+  }
 }
-